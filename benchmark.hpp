@@ -0,0 +1,106 @@
+#pragma once
+
+/// Helpers for benchmark and quality drivers that repeat a measurement and report it.
+///
+/// Summarize() reduces repeated samples to their mean, standard deviation, extremes and
+/// the half-width of a 95% confidence interval for the mean, using Student's t
+/// distribution since drivers usually take few repetitions. RunningSummary computes the
+/// same in constant space for samples that arrive one at a time. JsonString() and
+/// JsonSummary() format a string and a Summary for the drivers' hand-written JSON output.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Summary {
+  size_t count = 0;
+  double mean = 0, stddev = 0, min = 0, max = 0;
+  // The mean is within ci95 of the true mean with 95% confidence.
+  double ci95 = 0;
+};
+
+// The 97.5th percentile of Student's t distribution with df degrees of freedom.
+inline double StudentT975(size_t df) {
+  static const double TABLE[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+      2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+      2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  if (df == 0) return INFINITY;
+  if (df <= 30) return TABLE[df - 1];
+  // Past the table, the normal quantile with the first term of its expansion in 1/df.
+  return 1.960 + 2.4 / df;
+}
+
+inline Summary Summarize(const std::vector<double>& samples) {
+  Summary result;
+  result.count = samples.size();
+  if (samples.empty()) return result;
+  result.min = *std::min_element(samples.begin(), samples.end());
+  result.max = *std::max_element(samples.begin(), samples.end());
+  for (const double x : samples) result.mean += x;
+  result.mean /= samples.size();
+  if (samples.size() < 2) return result;
+  double squares = 0;
+  for (const double x : samples) squares += (x - result.mean) * (x - result.mean);
+  result.stddev = std::sqrt(squares / (samples.size() - 1));
+  result.ci95 =
+      StudentT975(samples.size() - 1) * result.stddev / std::sqrt(samples.size());
+  return result;
+}
+
+// Summarize() of the samples passed to Add(), without keeping them. The mean and
+// variance are updated with Welford's method.
+class RunningSummary {
+  size_t count_ = 0;
+  double mean_ = 0, squares_ = 0, min_ = 0, max_ = 0;
+
+ public:
+  void Add(double x) {
+    min_ = count_ ? std::min(min_, x) : x;
+    max_ = count_ ? std::max(max_, x) : x;
+    ++count_;
+    const double delta = x - mean_;
+    mean_ += delta / count_;
+    squares_ += delta * (x - mean_);
+  }
+
+  Summary Get() const {
+    Summary result;
+    result.count = count_;
+    result.mean = mean_;
+    result.min = min_;
+    result.max = max_;
+    if (count_ < 2) return result;
+    result.stddev = std::sqrt(squares_ / (count_ - 1));
+    result.ci95 = StudentT975(count_ - 1) * result.stddev / std::sqrt(count_);
+    return result;
+  }
+};
+
+inline std::string JsonString(const std::string& s) {
+  std::string result = "\"";
+  for (const char c : s) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escape[8];
+      std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+      result += escape;
+    } else {
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+
+inline std::string JsonSummary(const Summary& s) {
+  std::ostringstream out;
+  out << "{\"count\": " << s.count << ", \"mean\": " << s.mean << ", \"stddev\": "
+      << s.stddev << ", \"ci95\": " << s.ci95 << ", \"min\": " << s.min
+      << ", \"max\": " << s.max << "}";
+  return out.str();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+/// Helpers shared by the *-test.cpp drivers.
+///
+/// Check() ends a test with a message on its first failure. MaxError() scores a
+/// sketch against the exact ranks of its stream.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "rank-oracle.hpp"
+
+inline void Check(bool ok, const char* what) {
+  if (ok) return;
+  std::cerr << "FAILED: " << what << std::endl;
+  std::exit(1);
+}
+
+// The largest distance, in percentiles, between p and the range of percentiles that
+// sketch.GetCdf().GetValue(p) covers in the stream, for p = 1..99.
+template <typename Sketch, typename T>
+double MaxError(const Sketch& sketch, const RankOracle<T>& oracle) {
+  const auto cdf = sketch.GetCdf();
+  double result = 0;
+  for (int p = 1; p < 100; ++p) {
+    const auto range = oracle.Range(cdf.GetValue(p));
+    result = std::max({result, 100 * range.first - p, p - 100 * range.second});
+  }
+  return result;
+}
+
+template <typename Sketch, typename T>
+double MaxError(const Sketch& sketch, const std::vector<T>& keys) {
+  return MaxError(sketch, RankOracle<T>::FromKeys(keys));
+}
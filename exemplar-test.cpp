@@ -0,0 +1,42 @@
+#include "kll.hpp"
+#include "sampled-kll.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace std;
+
+string TraceId(int key) { return "trace-" + to_string(key); }
+
+// Inserts keys tagged with a payload derived from the key, through Insert,
+// InsertWeighted, and Merge, and checks that every quantile's exemplar still belongs to
+// that quantile's key after all the compactions.
+template <typename Sketch>
+void Check(const char* name) {
+  mt19937_64 r(2718);
+  uniform_int_distribution<int> keys(0, 99999);
+  Sketch left, right;
+  for (int i = 0; i < 200000; ++i) {
+    const int key = keys(r);
+    left.Insert(&r, key, 0, TraceId(key));
+    const int other = keys(r);
+    right.InsertWeighted(&r, other, 1 + other % 5, TraceId(other));
+  }
+  left.Merge(&r, right);
+  const auto cdf = left.GetCdf();
+  for (double p = 0; p <= 100; p += 0.25) {
+    if (cdf.GetExemplar(p) != TraceId(cdf.GetValue(p))) {
+      cerr << name << " exemplar " << cdf.GetExemplar(p) << " for key "
+           << cdf.GetValue(p) << endl;
+      exit(1);
+    }
+  }
+  cout << "OK " << name << endl;
+}
+
+int main() {
+  Check<SampledKll<int, 200, string>>("SampledKll");
+  Check<Kll<int, 200, string>>("Kll");
+}
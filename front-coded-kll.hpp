@@ -0,0 +1,207 @@
+#pragma once
+
+/// A KLL sketch of strings whose compacted levels are front coded.
+///
+/// FrontCodedKll<BYTES> has Kll's levels and compaction schedule, but budgets each level
+/// in bytes rather than keys. Keys inserted directly into a level wait there as
+/// std::strings. Compacting a level merges its keys in sorted order and keeps every
+/// other one, as Kll does, and the survivors reach the next level as a sealed
+/// FrontCodedRun (see front-coding.hpp) instead of as separate strings. Keys that share
+/// prefixes, such as URLs or dictionary words, take a fraction of their std::string size
+/// once coded, so the same budget holds several times as many keys as
+/// Kll<std::string, N> and answers more accurately.
+///
+/// Compaction and Rank() decode runs one key at a time and never expand a whole level.
+/// GetCdf() merges the runs of every level in order, and so skips the sort, but the Cdf
+/// it returns holds each distinct key as a std::string.
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "front-coding.hpp"
+#include "memory.hpp"
+#include "utility.hpp"
+
+template <uint32_t BYTES>
+struct FrontCodedKll {
+ private:
+  struct Level {
+    // Keys inserted at this level, unsorted.
+    std::vector<std::string> pending;
+    std::vector<FrontCodedRun> runs;
+    size_t bytes = 0;
+  };
+
+  std::vector<Level> levels_ = std::vector<Level>(1);
+
+  // Keeps the lowest levels from compacting on every insert once there are many levels.
+  static constexpr size_t MIN_LEVEL_BYTES = 256;
+
+  static size_t KeyBytes(const std::string& key) {
+    return sizeof(std::string) + key.size();
+  }
+
+  // As in Kll, the top level gets a third of the budget and each level below it two
+  // thirds of the level above.
+  size_t Limit(uint16_t level) const {
+    double limit = BYTES / 3.0;
+    for (size_t i = level + 1; i < levels_.size(); ++i) limit = limit * 2 / 3;
+    return std::max<size_t>(MIN_LEVEL_BYTES, limit);
+  }
+
+  // Calls f on the keys of sorted_pending and runs, merged in sorted order.
+  template <typename F>
+  static void ForEachSorted(const std::vector<std::string>& sorted_pending,
+      const std::vector<FrontCodedRun>& runs, const F& f) {
+    std::vector<FrontCodedRun::Cursor> cursors;
+    for (const auto& run : runs) cursors.emplace_back(run);
+    size_t next_pending = 0;
+    while (true) {
+      const std::string* smallest = nullptr;
+      size_t from = cursors.size();
+      if (next_pending < sorted_pending.size()) smallest = &sorted_pending[next_pending];
+      for (size_t i = 0; i < cursors.size(); ++i) {
+        if (!cursors[i].Done() && (!smallest || cursors[i].Key() < *smallest)) {
+          smallest = &cursors[i].Key();
+          from = i;
+        }
+      }
+      if (!smallest) return;
+      f(*smallest);
+      if (from == cursors.size()) {
+        ++next_pending;
+      } else {
+        cursors[from].Next();
+      }
+    }
+  }
+
+  template <typename Random>
+  void Compact(Random* rgen, uint16_t level) {
+    // Appending to the next level can compact it or add a level, so the level is moved
+    // out of levels_ first.
+    Level full;
+    std::swap(full, levels_[level]);
+    std::uniform_int_distribution<uint32_t> dist(0, 1);
+    uint32_t parity = dist(*rgen);
+    FrontCodedRun::Builder builder;
+    std::sort(full.pending.begin(), full.pending.end());
+    ForEachSorted(full.pending, full.runs, [&](const std::string& key) {
+      if (parity == 0) builder.Add(key);
+      parity ^= 1;
+    });
+    FrontCodedRun run = builder.Finish();
+    if (run.size() > 0) AppendRun(rgen, std::move(run), level + 1);
+  }
+
+  template <typename Random>
+  void AppendRun(Random* rgen, FrontCodedRun run, uint16_t level) {
+    while (level >= levels_.size()) levels_.emplace_back();
+    levels_[level].bytes += sizeof(FrontCodedRun) + run.Bytes();
+    levels_[level].runs.push_back(std::move(run));
+    if (levels_[level].bytes > Limit(level)) Compact(rgen, level);
+  }
+
+ public:
+  size_t MemoryUsage() const {
+    size_t result = sizeof(*this) + levels_.capacity() * sizeof(Level);
+    for (const auto& level : levels_) {
+      result += HeapBytes(level.pending) + level.runs.capacity() * sizeof(FrontCodedRun);
+      for (const auto& run : level.runs) result += run.Bytes();
+    }
+    return result;
+  }
+
+  template <typename Random>
+  void Insert(Random* rgen, const std::string& key, uint16_t level) {
+    while (level >= levels_.size()) levels_.emplace_back();
+    levels_[level].pending.push_back(key);
+    levels_[level].bytes += KeyBytes(key);
+    if (levels_[level].bytes > Limit(level)) Compact(rgen, level);
+  }
+
+  template <typename Random>
+  void InsertWeighted(Random* rgen, const std::string& key, uint64_t weight) {
+    for (uint16_t level = 0; level < 64 && (weight >> level) > 0; ++level) {
+      if (((weight >> level) & 1) == 0) continue;
+      SplitHeavy(level, [this](int h) { return h < static_cast<int>(levels_.size()); },
+          [&](int h) { Insert(rgen, key, h); });
+    }
+  }
+
+  // The estimated total weight of the keys less than key.
+  uint64_t Rank(const std::string& key) const {
+    uint64_t result = 0;
+    for (uint16_t level = 0; level < levels_.size(); ++level) {
+      uint64_t count = 0;
+      for (const auto& run : levels_[level].runs) count += run.Rank(key);
+      for (const auto& pending : levels_[level].pending) count += pending < key;
+      result += count << level;
+    }
+    return result;
+  }
+
+  // Merges every level in sorted order, so that the keys reach Cdf already sorted. Among
+  // equal keys, lower levels come first, as they would after sorting the pairs.
+  Cdf<std::string> GetCdf() const {
+    std::vector<std::vector<std::string>> pending;
+    std::vector<size_t> next_pending(levels_.size(), 0);
+    std::vector<FrontCodedRun::Cursor> cursors;
+    std::vector<uint16_t> cursor_levels;
+    for (uint16_t level = 0; level < levels_.size(); ++level) {
+      pending.push_back(levels_[level].pending);
+      std::sort(pending.back().begin(), pending.back().end());
+      for (const auto& run : levels_[level].runs) {
+        cursors.emplace_back(run);
+        cursor_levels.push_back(level);
+      }
+    }
+    std::vector<std::pair<std::string, double>> raw;
+    while (true) {
+      const std::string* smallest = nullptr;
+      uint16_t smallest_level = 0;
+      size_t from = cursors.size();
+      const auto consider = [&](const std::string& key, uint16_t level, size_t source) {
+        if (smallest && !(key < *smallest)
+            && (*smallest < key || smallest_level <= level)) {
+          return;
+        }
+        smallest = &key;
+        smallest_level = level;
+        from = source;
+      };
+      for (uint16_t level = 0; level < levels_.size(); ++level) {
+        if (next_pending[level] < pending[level].size()) {
+          consider(pending[level][next_pending[level]], level, cursors.size());
+        }
+      }
+      for (size_t i = 0; i < cursors.size(); ++i) {
+        if (!cursors[i].Done()) consider(cursors[i].Key(), cursor_levels[i], i);
+      }
+      if (!smallest) break;
+      raw.push_back({*smallest, static_cast<double>(uint64_t{1} << smallest_level)});
+      if (from == cursors.size()) {
+        ++next_pending[smallest_level];
+      } else {
+        cursors[from].Next();
+      }
+    }
+    return Cdf<std::string>(raw);
+  }
+
+  template <typename Random>
+  void Merge(Random* rgen, const FrontCodedKll& that) {
+    for (uint16_t level = 0; level < that.levels_.size(); ++level) {
+      for (const auto& key : that.levels_[level].pending) Insert(rgen, key, level);
+      for (const auto& run : that.levels_[level].runs) AppendRun(rgen, run, level);
+    }
+  }
+};
+
+template <uint32_t BYTES>
+constexpr size_t FrontCodedKll<BYTES>::MIN_LEVEL_BYTES;
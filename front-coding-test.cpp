@@ -0,0 +1,99 @@
+#include "front-coded-kll.hpp"
+#include "front-coding.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// URL-like keys with long shared prefixes, many duplicates, and the empty string.
+vector<string> Keys(mt19937_64* r, size_t count) {
+  const vector<string> hosts = {"https://example.com/", "https://example.org/",
+      "https://en.wikipedia.org/wiki/", "http://a.b/"};
+  vector<string> keys = {""};
+  while (keys.size() < count) {
+    string key = hosts[(*r)() % hosts.size()];
+    const int depth = (*r)() % 4;
+    for (int i = 0; i < depth; ++i) key += "section-" + to_string((*r)() % 50) + "/";
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+// Decoding a run must return exactly the keys it was built from, and Rank must agree
+// with std::lower_bound for keys inside, between and outside them.
+void CheckRun(mt19937_64* r) {
+  for (const size_t count : {0, 1, 15, 16, 17, 1000}) {
+    vector<string> keys = Keys(r, count);
+    keys.resize(count);
+    sort(keys.begin(), keys.end());
+    FrontCodedRun::Builder builder;
+    for (const auto& key : keys) builder.Add(key);
+    const FrontCodedRun run = builder.Finish();
+    vector<string> decoded;
+    for (FrontCodedRun::Cursor c(run); !c.Done(); c.Next()) decoded.push_back(c.Key());
+    if (decoded != keys) {
+      cerr << "round trip failed for " << count << " keys" << endl;
+      exit(1);
+    }
+    vector<string> probes = Keys(r, 200);
+    probes.insert(probes.end(), {"", "a", "zzz", "https://example.com"});
+    for (const auto& probe : probes) {
+      const size_t expected = lower_bound(keys.begin(), keys.end(), probe) - keys.begin();
+      if (run.Rank(probe) != expected) {
+        cerr << "Rank(" << probe << ") is " << run.Rank(probe) << ", not " << expected
+             << endl;
+        exit(1);
+      }
+    }
+    size_t raw = 0;
+    for (const auto& key : keys) raw += sizeof(string) + key.size();
+    cout << count << " keys: " << raw << " bytes as strings, " << run.Bytes()
+         << " front coded" << endl;
+  }
+}
+
+// The sketch's ranks and quantiles must stay close to the exact ones.
+void CheckSketch(mt19937_64* r) {
+  const vector<string> keys = Keys(r, 300000);
+  FrontCodedKll<32000> left, right;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    (i % 2 ? left : right).Insert(r, keys[i], 0);
+  }
+  left.Merge(r, right);
+  map<string, uint64_t> exact;
+  for (const auto& key : keys) ++exact[key];
+  // range[key] is the exact percentile range that key covers.
+  map<string, pair<double, double>> range;
+  uint64_t below = 0;
+  double max_error = 0;
+  const double total = keys.size(), estimated_total = left.Rank("~");
+  for (const auto& p : exact) {
+    range[p.first] = {100.0 * below / total, 100.0 * (below + p.second) / total};
+    max_error = max(max_error,
+        abs(100.0 * left.Rank(p.first) / estimated_total - range[p.first].first));
+    below += p.second;
+  }
+  const auto cdf = left.GetCdf();
+  // GetCdf merges the levels rather than sorting them, and must visit every key.
+  if (cdf.Total() != estimated_total) exit(1);
+  for (double p = 1; p < 100; p += 1) {
+    const auto& truth = range[cdf.GetValue(p)];
+    max_error = max({max_error, truth.first - p, p - truth.second});
+  }
+  cout << "FrontCodedKll max error " << max_error << " percentile" << endl;
+  if (max_error > 3.0) exit(1);
+}
+
+int main() {
+  mt19937_64 r(42);
+  CheckRun(&r);
+  CheckSketch(&r);
+  cout << "OK" << endl;
+}
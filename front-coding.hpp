@@ -0,0 +1,161 @@
+#pragma once
+
+/// Front-coded runs of sorted strings.
+///
+/// A FrontCodedRun holds a sorted sequence of strings in one byte buffer. Keys are
+/// grouped in blocks of BLOCK. The first key of each block, the restart point, is stored
+/// whole; every other key is stored as the length of the prefix it shares with the key
+/// before it, followed by the rest of its bytes. Sorted URLs and dictionary words share
+/// long prefixes, so a run is usually several times smaller than the std::strings it
+/// replaces, and scanning it touches a single contiguous buffer.
+///
+/// Runs are immutable once built. A Cursor decodes them in order one key at a time, and
+/// Rank() binary searches the restart points and then decodes a single block.
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class FrontCodedRun {
+ public:
+  static constexpr uint32_t BLOCK = 16;
+
+ private:
+  std::string bytes_;
+  // restarts_[b] is the offset in bytes_ of the first key of block b.
+  std::vector<uint32_t> restarts_;
+  uint32_t size_ = 0;
+
+  static void PutVarint(std::string* out, uint32_t x) {
+    while (x >= 0x80) {
+      out->push_back(static_cast<char>(x | 0x80));
+      x >>= 7;
+    }
+    out->push_back(static_cast<char>(x));
+  }
+
+  static uint32_t GetVarint(const char** in) {
+    uint32_t result = 0;
+    for (int shift = 0;; shift += 7) {
+      const uint8_t byte = static_cast<uint8_t>(*(*in)++);
+      result |= static_cast<uint32_t>(byte & 0x7f) << shift;
+      if (byte < 0x80) return result;
+    }
+  }
+
+  // Compares the restart key of block to key, like std::string::compare.
+  int CompareRestart(uint32_t block, const std::string& key) const {
+    const char* in = bytes_.data() + restarts_[block];
+    const uint32_t length = GetVarint(&in);
+    return -key.compare(0, key.size(), in, length);
+  }
+
+ public:
+  // Encodes keys, which must be added in sorted order, into a new run.
+  class Builder;
+
+  // Decodes a run in order. Key() is valid until the next call to Next().
+  class Cursor {
+    const FrontCodedRun* run_;
+    const char* in_;
+    uint32_t index_;
+    std::string key_;
+
+    void Decode() {
+      if (index_ >= run_->size_) return;
+      if (index_ % BLOCK == 0) {
+        const uint32_t length = GetVarint(&in_);
+        key_.assign(in_, length);
+        in_ += length;
+      } else {
+        const uint32_t shared = GetVarint(&in_);
+        const uint32_t length = GetVarint(&in_);
+        key_.resize(shared);
+        key_.append(in_, length);
+        in_ += length;
+      }
+    }
+
+   public:
+    explicit Cursor(const FrontCodedRun& run, uint32_t block = 0)
+        : run_(&run),
+          in_(run.bytes_.data() + (block < run.restarts_.size() ? run.restarts_[block]
+                                                                : run.bytes_.size())),
+          index_(std::min(block * BLOCK, run.size_)) {
+      Decode();
+    }
+
+    bool Done() const { return index_ >= run_->size_; }
+    uint32_t Index() const { return index_; }
+    const std::string& Key() const { return key_; }
+
+    void Next() {
+      ++index_;
+      Decode();
+    }
+  };
+
+  uint32_t size() const { return size_; }
+
+  // Bytes held by the run, not counting sizeof(FrontCodedRun).
+  size_t Bytes() const {
+    return bytes_.capacity() + restarts_.capacity() * sizeof(uint32_t);
+  }
+
+  // The number of keys in the run that are less than key.
+  uint32_t Rank(const std::string& key) const {
+    // Find the first block whose restart key is not less than key. Every key before the
+    // block before it is less than key, so only that block needs decoding.
+    uint32_t lo = 0, hi = restarts_.size();
+    while (lo < hi) {
+      const uint32_t mid = lo + (hi - lo) / 2;
+      if (CompareRestart(mid, key) < 0) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo == 0) return 0;
+    Cursor cursor(*this, lo - 1);
+    while (!cursor.Done() && cursor.Index() < lo * BLOCK && cursor.Key() < key) {
+      cursor.Next();
+    }
+    return cursor.Index();
+  }
+};
+
+class FrontCodedRun::Builder {
+  FrontCodedRun run_;
+  std::string last_;
+
+ public:
+  void Add(const std::string& key) {
+    assert(run_.size_ == 0 || !(key < last_));
+    if (run_.size_ % BLOCK == 0) {
+      run_.restarts_.push_back(run_.bytes_.size());
+      PutVarint(&run_.bytes_, key.size());
+      run_.bytes_.append(key);
+    } else {
+      uint32_t shared = 0;
+      const uint32_t limit = std::min(key.size(), last_.size());
+      while (shared < limit && key[shared] == last_[shared]) ++shared;
+      PutVarint(&run_.bytes_, shared);
+      PutVarint(&run_.bytes_, key.size() - shared);
+      run_.bytes_.append(key, shared, std::string::npos);
+    }
+    last_ = key;
+    ++run_.size_;
+  }
+
+  FrontCodedRun Finish() {
+    run_.bytes_.shrink_to_fit();
+    run_.restarts_.shrink_to_fit();
+    FrontCodedRun result;
+    std::swap(result, run_);
+    last_.clear();
+    return result;
+  }
+};
@@ -0,0 +1,86 @@
+#include "check.hpp"
+#include "hybrid-kll.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+constexpr int32_t N = 200;
+using Hybrid = HybridKll<uint32_t, N>;
+
+// SampledKll keeps the total weight only in expectation once it samples.
+bool CloseTotal(const Hybrid& sketch, size_t count) {
+  return abs(sketch.GetCdf().Total() - static_cast<double>(count)) < 0.05 * count;
+}
+
+// count keys from distinct values, inserted into a new sketch and appended to keys.
+Hybrid Make(mt19937_64* r, size_t count, uint32_t distinct, vector<uint32_t>* keys) {
+  Hybrid sketch;
+  for (size_t i = 0; i < count; ++i) {
+    const uint32_t key = (*r)() % distinct;
+    sketch.Insert(r, key, 0);
+    keys->push_back(key);
+  }
+  return sketch;
+}
+
+int main() {
+  mt19937_64 r(29);
+
+  // Up to N / 2 distinct keys, the sketch counts exactly.
+  vector<uint32_t> few;
+  Hybrid exact = Make(&r, 100000, N / 2, &few);
+  Check(exact.IsExact(), "exact below the limit");
+  Check(MaxError(exact, few) == 0, "exact answers");
+  Check(exact.GetCdf().Total() == few.size(), "exact total");
+  // Until it converts, the hybrid holds only its counts.
+  Check(Hybrid().MemoryUsage() == sizeof(Hybrid), "no sketch before conversion");
+  Check(sizeof(Hybrid) < SampledKll<uint32_t, N>().MemoryUsage(), "no larger");
+
+  // One more distinct key converts it, with weights intact.
+  exact.Insert(&r, N / 2, 0);
+  few.push_back(N / 2);
+  Check(!exact.IsExact(), "converts past the limit");
+  Check(CloseTotal(exact, few.size()), "total after conversion");
+  Check(MaxError(exact, few) < 4, "accuracy after conversion");
+
+  vector<uint32_t> many;
+  const Hybrid converted = Make(&r, 100000, 1000000, &many);
+  Check(!converted.IsExact(), "many distinct keys convert");
+  Check(MaxError(converted, many) < 6, "accuracy of a converted sketch");
+
+  // Exact + exact stays exact while the union fits.
+  {
+    vector<uint32_t> keys;
+    Hybrid a = Make(&r, 10000, N / 4, &keys);
+    const Hybrid b = Make(&r, 10000, N / 4, &keys);
+    a.Merge(&r, b);
+    Check(a.IsExact() && MaxError(a, keys) == 0, "exact + exact");
+  }
+  // Exact + converted, and converted + exact.
+  {
+    vector<uint32_t> keys;
+    Hybrid a = Make(&r, 10000, N / 4, &keys);
+    a.Merge(&r, converted);
+    keys.insert(keys.end(), many.begin(), many.end());
+    Check(!a.IsExact(), "exact + converted converts");
+    Check(CloseTotal(a, keys.size()), "exact + converted total");
+      Check(MaxError(a, keys) < 6, "exact + converted");
+  }
+  {
+    vector<uint32_t> keys = many;
+    Hybrid a = converted;
+    const Hybrid b = Make(&r, 100000, N / 4, &keys);
+    a.Merge(&r, b);
+    Check(!a.IsExact(), "converted + exact");
+    Check(CloseTotal(a, keys.size()), "converted + exact total");
+      Check(MaxError(a, keys) < 6, "converted + exact");
+  }
+  cout << "OK" << endl;
+}
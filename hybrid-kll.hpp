@@ -0,0 +1,106 @@
+#pragma once
+
+/// A sketch that is exact until it sees too many distinct keys.
+///
+/// HybridKll<T, N> counts every distinct key exactly, in a sorted array of (key, count)
+/// pairs, until a new key would push the number of distinct keys past N / 2. It then
+/// moves the counts into a SampledKll<T, N> with InsertWeighted and forwards all later
+/// operations to it. Metrics with a small domain, such as status codes, stay exact and
+/// never pay for compaction. The sketch is built only when the counts move into it, so
+/// until then the hybrid holds nothing but the counts.
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "memory.hpp"
+#include "sampled-kll.hpp"
+#include "utility.hpp"
+
+template <typename T, int32_t CAPACITY, typename Sketch = SampledKll<T, CAPACITY>>
+struct HybridKll {
+ private:
+  // Each count is about as large as a key, so half as many fit in the sketch's space.
+  static constexpr size_t DISTINCT_LIMIT = CAPACITY / 2;
+
+  using Count = std::pair<T, uint64_t>;
+  std::vector<Count> counts_;
+  // Null while the counts are exact.
+  std::unique_ptr<Sketch> sketch_;
+
+  template <typename Random>
+  void Convert(Random* rgen) {
+    sketch_ = std::make_unique<Sketch>();
+    for (const auto& count : counts_) {
+      sketch_->InsertWeighted(rgen, count.first, count.second);
+    }
+    std::vector<Count>().swap(counts_);
+  }
+
+ public:
+  HybridKll() = default;
+  HybridKll(HybridKll&&) = default;
+  HybridKll& operator=(HybridKll&&) = default;
+
+  HybridKll(const HybridKll& that)
+      : counts_(that.counts_),
+        sketch_(that.sketch_ ? std::make_unique<Sketch>(*that.sketch_) : nullptr) {}
+
+  HybridKll& operator=(const HybridKll& that) {
+    if (this != &that) *this = HybridKll(that);
+    return *this;
+  }
+
+  bool IsExact() const { return !sketch_; }
+
+  size_t MemoryUsage() const {
+    return sizeof(*this) + HeapBytes(counts_) + (sketch_ ? sketch_->MemoryUsage() : 0);
+  }
+
+  template <typename Random>
+  void Insert(Random* rgen, const T& key, int16_t height) {
+    if (sketch_) {
+      sketch_->Insert(rgen, key, height);
+      return;
+    }
+    InsertWeighted(rgen, key, uint64_t{1} << height);
+  }
+
+  template <typename Random>
+  void InsertWeighted(Random* rgen, const T& key, uint64_t weight) {
+    if (sketch_) {
+      sketch_->InsertWeighted(rgen, key, weight);
+      return;
+    }
+    const auto i = std::lower_bound(counts_.begin(), counts_.end(), key,
+        [](const Count& count, const T& k) { return count.first < k; });
+    if (i != counts_.end() && !(key < i->first)) {
+      i->second += weight;
+    } else if (counts_.size() < DISTINCT_LIMIT) {
+      counts_.insert(i, {key, weight});
+    } else {
+      Convert(rgen);
+      sketch_->InsertWeighted(rgen, key, weight);
+    }
+  }
+
+  Cdf<T> GetCdf() const {
+    if (sketch_) return sketch_->GetCdf();
+    return Cdf<T>(counts_);
+  }
+
+  template <typename Random>
+  void Merge(Random* rgen, const HybridKll& that) {
+    if (!that.sketch_) {
+      for (const auto& count : that.counts_) {
+        InsertWeighted(rgen, count.first, count.second);
+      }
+      return;
+    }
+    if (!sketch_) Convert(rgen);
+    sketch_->Merge(rgen, *that.sketch_);
+  }
+};
@@ -1,33 +1,148 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdint>
-#include <deque>
 #include <iostream>
 #include <memory>
 #include <random>
 #include <utility>
 #include <vector>
 
+#include "memory.hpp"
+#include "numeric-sort.hpp"
+#include "payload.hpp"
+#include "stats.hpp"
 #include "utility.hpp"
+#include "watched-quantiles.hpp"
+#include "weighted-cdf.hpp"
 
-template<typename T, uint32_t CAPACITY>
-struct Kll {
+// The compaction policies say when Kll compacts. EagerCompaction compacts a level as
+// soon as it reaches its size limit, so lower levels, whose limits are small, compact
+// on nearly every insert and stay mostly empty.
+struct EagerCompaction {
+  static constexpr bool LAZY = false;
+};
+
+// LazyCompaction, the scheme of the lazy KLL, compacts only when the whole sketch
+// reaches the sum of its levels' size limits, and then only the lowest level that has
+// reached its own limit. Levels may hold more than their limit while others have room,
+// so fewer keys lose weight. Its limits are at least eight keys, so that a compaction
+// frees enough room to be worth it.
+struct LazyCompaction {
+  static constexpr bool LAZY = true;
+};
+
+// CAPACITY is measured by the Budget policy (see memory.hpp): keys by default, or bytes
+// with ByteBudget.
+template<typename T, uint32_t CAPACITY, typename Payload = NoPayload,
+    typename Stats = NoStats, typename Budget = ItemBudget,
+    typename Compaction = EagerCompaction>
+struct Kll : private Stats {
 private:
   std::vector<std::vector<T>> data_;
-  std::deque<uint32_t> size_limits_;
+  // payloads_[level] runs parallel to data_[level].
+  std::vector<PayloadVector<Payload>> payloads_;
+  // costs_[level] is the Budget cost of data_[level], compared against its size limit.
+  std::vector<uint64_t> costs_;
+  // The sums of costs_ and of the levels' size limits.
+  uint64_t cost_, capacity_;
   uint64_t size_;
+  WatchedQuantiles<T> watch_;
+  // Stats is a private base; see stats.hpp.
+  Stats& stats() { return *this; }
+  const Stats& stats() const { return *this; }
   static uint32_t Round(uint32_t x) { return 2 * (x / 2); }
 
+  // Limits()[depth] is the size limit of the level depth levels below the top one: a
+  // third of CAPACITY for the top level, and two thirds of that for each level below.
+  static const std::array<uint32_t, 64>& Limits() {
+    static const std::array<uint32_t, 64> limits = [] {
+      std::array<uint32_t, 64> result;
+      result[0] = Round(CAPACITY / 3);
+      for (size_t depth = 1; depth < result.size(); ++depth) {
+        result[depth] = Round(result[depth - 1] * 2 / 3);
+      }
+      return result;
+    }();
+    return limits;
+  }
+
+  uint64_t SizeLimit(uint16_t level) const {
+    const uint64_t limit = Limits()[data_.size() - 1 - level];
+    return Compaction::LAZY ? std::max<uint64_t>(limit, 8 * Budget::Cost(T())) : limit;
+  }
+
+  void AddLevel() {
+    data_.push_back(std::vector<T>());
+    payloads_.emplace_back();
+    costs_.push_back(0);
+    capacity_ = 0;
+    for (uint16_t level = 0; level < data_.size(); ++level) capacity_ += SizeLimit(level);
+  }
+
+  // The weight of each key of a level, in the units of GetCdf().
+  static double Weight(uint16_t level) { return 2.0 * (uint64_t{1} << level); }
+
+  void UpdateWatch() {
+    if (size_ == 0 || !watch_.NeedsRefresh()) return;
+    stats().OnWatchRefresh();
+    watch_.Refresh(GetCdf());
+  }
+
  public:
-  explicit Kll() : data_(), size_limits_(), size_(0) {
-    size_limits_.push_back(Round(CAPACITY / 3));
-    data_.emplace_back();
+  explicit Kll()
+      : data_(), payloads_(), costs_(), cost_(0), capacity_(0), size_(0),
+        watch_(16 * CAPACITY) {
+    AddLevel();
+  }
+
+  // Copies must rebind size to their own size_ rather than the original's.
+  Kll(const Kll& that)
+      : Stats(that),
+        data_(that.data_),
+        payloads_(that.payloads_),
+        costs_(that.costs_),
+        cost_(that.cost_),
+        capacity_(that.capacity_),
+        size_(that.size_),
+        watch_(that.watch_) {}
+
+  Kll& operator=(const Kll& that) {
+    data_ = that.data_;
+    payloads_ = that.payloads_;
+    costs_ = that.costs_;
+    cost_ = that.cost_;
+    capacity_ = that.capacity_;
+    size_ = that.size_;
+    stats() = that.stats();
+    watch_ = that.watch_;
+    return *this;
   }
 
   const uint64_t& size = size_;
 
+  SketchStats GetStats() const { return stats().Snapshot(); }
+
+  size_t MemoryUsage() const {
+    return sizeof(*this) + HeapBytes(data_) + HeapBytes(payloads_) + HeapBytes(costs_)
+        + watch_.HeapBytes();
+  }
+
+  // Keeps the key at percentile current as keys arrive, to within tolerance
+  // percentiles; see watched-quantiles.hpp. A tolerance of a small fraction of the
+  // sketch's error, such as 0.01, avoids most recomputation. Returns the index to pass
+  // to GetWatched().
+  size_t Watch(double percentile, double tolerance = 0) {
+    const size_t result = watch_.Watch(percentile, tolerance);
+    UpdateWatch();
+    return result;
+  }
+
+  // GetCdf().GetValue(percentile) for the i-th watched percentile, in O(1) time.
+  const T& GetWatched(size_t i) const { return watch_.Get(i); }
+
   void PrintMetaData() {
     return;
     for (const auto & level : data_) {
@@ -47,38 +162,122 @@ private:
   }
 
   template <typename Random>
-  void Insert(Random* rgen, const T& key, uint16_t level) {
+  void Insert(
+      Random* rgen, const T& key, uint16_t level, const Payload& payload = Payload()) {
+    Place(rgen, key, level, payload);
+    watch_.Add(key, Weight(level));
+    UpdateWatch();
+  }
+
+ private:
+  // Insert, without reporting the key to the watch.
+  template <typename Random>
+  void Place(Random* rgen, const T& key, uint16_t level, const Payload& payload) {
     assert (level <= data_.size());
-    assert (size_limits_.size() == data_.size());
+    if (level >= data_.size()) AddLevel();
+    if (!Compaction::LAZY && costs_[level] >= SizeLimit(level)) Compact(rgen, level);
+    Append(key, level, payload);
+    while (Compaction::LAZY && cost_ >= capacity_) {
+      uint16_t lowest = 0;
+      while (lowest < data_.size()
+          && (data_[lowest].size() < 2 || costs_[lowest] < SizeLimit(lowest))) {
+        ++lowest;
+      }
+      // Only keys too heavy for their level's limit are left.
+      if (lowest == data_.size()) break;
+      Compact(rgen, lowest);
+    }
+  }
+
+  void Append(const T& key, uint16_t level, const Payload& payload) {
     ++size_;
-    if (level >= data_.size()) {
-      data_.push_back(std::vector<T>());
-      size_limits_.push_front(Round(size_limits_[0] * 2 / 3));
+    if (level >= data_.size()) AddLevel();
+    data_[level].push_back(key);
+    const uint64_t cost = Budget::Cost(data_[level].back());
+    costs_[level] += cost;
+    cost_ += cost;
+    payloads_[level].push_back(payload);
+  }
+
+  // Sorts level and moves every other key, from a random start, to the level above, at
+  // twice the weight. Eager compaction places them there with Place, which may compact
+  // that level in turn.
+  template <typename Random>
+  void Compact(Random* rgen, uint16_t level) {
+    PrintMetaData();
+    stats().OnCompaction(level, data_[level].size());
+    if (data_[level].size() > 2) {
+      SortWithPayloads(data_[level].data(), data_[level].size(), &payloads_[level], 0,
+          stats().Comparisons());
     }
-    if (data_[level].size() >= size_limits_[level]) {
-      PrintMetaData();
-      if (data_[level].size() > 2) {
-        std::sort(data_[level].begin(), data_[level].end());
-      }
-      std::uniform_int_distribution<uint32_t> dist(0,1);
-      for (uint32_t i = dist(*rgen); i < data_[level].size(); i += 2) {
-        Insert(rgen, data_[level][i], level+1);
+    stats().OnRandomDraw();
+    stats().OnBytesMoved(data_[level].size() / 2 * sizeof(T));
+    std::uniform_int_distribution<uint32_t> dist(0,1);
+    const uint32_t offset = dist(*rgen);
+    watch_.Compact(data_[level].data(), data_[level].size(), offset, Weight(level));
+    for (uint32_t i = offset; i < data_[level].size(); i += 2) {
+      if (Compaction::LAZY) {
+        Append(data_[level][i], level + 1, payloads_[level][i]);
+      } else {
+        Place(rgen, data_[level][i], level + 1, payloads_[level][i]);
       }
+    }
+    // Size limits of lower levels shrink as levels are added above them, so a level
+    // gives back capacity it outgrew while it was nearer the top. A lazy level may grow
+    // far past its limit, so it starts over at its limit.
+    if (Compaction::LAZY || data_[level].capacity() > 2 * data_[level].size()) {
+      std::vector<T> fresh;
+      fresh.reserve(Compaction::LAZY ? SizeLimit(level) / Budget::Cost(T())
+                                     : data_[level].size());
+      data_[level].swap(fresh);
+      payloads_[level] = PayloadVector<Payload>();
+    } else {
       data_[level].clear();
+      payloads_[level].clear();
     }
-    data_[level].push_back(key);
+    cost_ -= costs_[level];
+    costs_[level] = 0;
+  }
+
+ public:
+  // Inserts key with an arbitrary weight, such as a (value, count) pair from a
+  // pre-aggregated feed, by inserting it once at each level whose weight is a binary
+  // digit of weight.
+  template <typename Random>
+  void InsertWeighted(
+      Random* rgen, const T& key, uint64_t weight, const Payload& payload = Payload()) {
+    for (uint16_t level = 0; level < 64 && (weight >> level) > 0; ++level) {
+      if (((weight >> level) & 1) == 0) continue;
+      SplitHeavy(level, [this](int h) { return h < static_cast<int>(data_.size()); },
+          [&](int h) { Place(rgen, key, h, payload); });
+    }
+    watch_.Add(key, Weight(0) * weight);
+    UpdateWatch();
   }
 
  public:
-  Cdf<T> GetCdf() const {
+  Cdf<T, Payload> GetCdf() const {
     std::vector<std::pair<T, int64_t>> result;
+    PayloadVector<Payload> payloads;
     int64_t weight = 1;
-    for (const auto& d : data_) {
+    for (uint16_t level = 0; level < data_.size(); ++level) {
       weight *= 2;
-      for (const auto& v : d) result.push_back({v, weight});
+      for (uint32_t i = 0; i < data_[level].size(); ++i) {
+        result.push_back({data_[level][i], weight});
+        payloads.push_back(payloads_[level][i]);
+      }
+    }
+    SortWithPayloads(result.data(), result.size(), &payloads, 0);
+    return Cdf<T, Payload>(result, payloads);
+  }
+
+  // Each key of level h weighs 2^h keys of the stream; see weighted-cdf.hpp.
+  WeightedCdf<T> GetWeightedCdf() const {
+    std::vector<std::pair<T, uint64_t>> raw;
+    for (uint16_t level = 0; level < data_.size(); ++level) {
+      for (const T& key : data_[level]) raw.push_back({key, uint64_t{1} << level});
     }
-    std::sort(result.begin(), result.end());
-    return Cdf<T>(result);
+    return WeightedCdf<T>::FromUnsorted(std::move(raw));
   }
 
  public:
@@ -88,13 +287,22 @@ private:
 
   template <typename Random>
   void Merge(Random* rgen, const Kll& that) {
-    uint16_t level = 0;
-    for (const auto& row : that.data_) {
-      for (const auto& key : row) {
-        Insert(rgen, key, level);
+    for (uint16_t level = 0; level < that.data_.size(); ++level) {
+      for (uint32_t i = 0; i < that.data_[level].size(); ++i) {
+        Insert(rgen, that.data_[level][i], level, that.payloads_[level][i]);
       }
-      ++level;
     }
     size_ += that.size_;
   }
 };
+
+// A Kll whose levels are limited to a total of about BYTES bytes of keys, counting the
+// heap bytes of long strings, rather than to a number of keys. Vector growth and the key
+// each level may hold past its limit put its peak MemoryUsage() at up to about 1.5 times
+// BYTES; see memory-benchmark.cpp.
+template <typename T, uint32_t BYTES>
+using ByteKll = Kll<T, BYTES, NoPayload, NoStats, ByteBudget>;
+
+// A Kll that compacts lazily; see LazyCompaction.
+template <typename T, uint32_t CAPACITY>
+using LazyKll = Kll<T, CAPACITY, NoPayload, NoStats, ItemBudget, LazyCompaction>;
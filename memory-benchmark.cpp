@@ -0,0 +1,86 @@
+#include "front-coded-kll.hpp"
+#include "kll.hpp"
+#include "sampled-kll.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Keys from 8 to 80 characters, so that most of them own heap memory.
+vector<string> MakeKeys(size_t count) {
+  mt19937_64 r(0);
+  vector<string> keys;
+  for (size_t i = 0; i < count; ++i) {
+    string key = "/user/" + to_string(r() % 100000);
+    const int depth = r() % 6;
+    for (int j = 0; j < depth; ++j) key += "/item-" + to_string(r() % 1000);
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+// Prints the peak MemoryUsage() over the stream and the mean and worst error, in
+// percentiles, of the 1st through 99th percentiles, averaged over trials.
+template <typename Sketch>
+void Measure(const char* name, uint32_t capacity, const vector<string>& keys,
+    const RankOracle<string>& truth, int trials) {
+  mt19937_64 r(1);
+  size_t peak = 0;
+  double sum_error = 0, max_error = 0;
+  for (int trial = 0; trial < trials; ++trial) {
+    Sketch sketch;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      sketch.Insert(&r, keys[i], 0);
+      if (i % 1024 == 0) peak = max(peak, sketch.MemoryUsage());
+    }
+    peak = max(peak, sketch.MemoryUsage());
+    const auto cdf = sketch.GetCdf();
+    for (int q = 1; q < 100; ++q) {
+      const auto range = truth.Range(cdf.GetValue(q));
+      const double p = q / 100.0;
+      const double error = 100 * max({0.0, range.first - p, p - range.second});
+      sum_error += error;
+      max_error = max(max_error, error);
+    }
+  }
+  cout << left << setw(14) << name << right << setw(9) << capacity << setw(10) << peak
+       << fixed << setprecision(4) << setw(11) << sum_error / (99 * trials)
+       << setw(10) << max_error << endl;
+}
+
+template <uint32_t N>
+void MeasureAll(const vector<string>& keys,
+    const RankOracle<string>& truth, int trials) {
+  // A std::string is 32 bytes, so the byte budgets match the item counts on keys that
+  // fit the small-string buffer.
+  constexpr uint32_t BYTES = N * sizeof(string);
+  Measure<SampledKll<string, N>>("SampledKll", N, keys, truth, trials);
+  Measure<Kll<string, N>>("Kll", N, keys, truth, trials);
+  Measure<ByteKll<string, BYTES>>("ByteKll", BYTES, keys, truth, trials);
+  Measure<FrontCodedKll<BYTES>>("FrontCodedKll", BYTES, keys, truth, trials);
+}
+
+int main(int argc, char** argv) {
+  const int trials = (argc > 1) ? StringCast<int>(argv[1]) : 10;
+  vector<string> keys;
+  if (argc > 2) {
+    ifstream file(argv[2]);
+    string word;
+    while (file >> word) keys.push_back(word);
+  } else {
+    keys = MakeKeys(200000);
+  }
+  const auto truth = GroundTruth(keys);
+  cout << left << setw(14) << "sketch" << right << setw(9) << "capacity" << setw(10)
+       << "peak B" << setw(11) << "mean err" << setw(10) << "max err" << endl;
+  MeasureAll<250>(keys, truth, trials);
+  MeasureAll<500>(keys, truth, trials);
+  MeasureAll<1000>(keys, truth, trials);
+  MeasureAll<2000>(keys, truth, trials);
+}
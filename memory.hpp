@@ -0,0 +1,96 @@
+#pragma once
+
+/// Memory accounting for sketches.
+///
+/// Every sketch has a MemoryUsage() method that returns the bytes it occupies. That
+/// total counts the object itself, the buffers its containers own, and the heap bytes
+/// its keys own, such as the characters of a std::string too long for its small-string
+/// buffer. HeapBytes(x) measures those last two parts for a value x and is zero for
+/// values that own no memory.
+///
+/// The capacity policies say how much of a sketch's CAPACITY one key uses. ItemBudget
+/// makes CAPACITY a number of keys. ByteBudget makes it a number of bytes, so a sketch
+/// of strings compacts sooner when its keys are long.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "payload.hpp"
+
+template <typename T>
+size_t HeapBytes(const T&) {
+  return 0;
+}
+
+inline size_t HeapBytes(const std::string& s) {
+  const char* const object = reinterpret_cast<const char*>(&s);
+  if (object <= s.data() && s.data() < object + sizeof(s)) return 0;
+  return s.capacity() + 1;
+}
+
+template <typename T, typename U>
+size_t HeapBytes(const std::pair<T, U>& p) {
+  return HeapBytes(p.first) + HeapBytes(p.second);
+}
+
+template <typename T, size_t N>
+size_t HeapBytes(const std::array<T, N>& a) {
+  size_t result = 0;
+  for (const auto& x : a) result += HeapBytes(x);
+  return result;
+}
+
+template <typename T>
+size_t HeapBytes(const std::vector<T>& v) {
+  size_t result = v.capacity() * sizeof(T);
+  for (const auto& x : v) result += HeapBytes(x);
+  return result;
+}
+
+// libstdc++ keeps a deque in 512-byte nodes plus a map of at least eight node pointers.
+template <typename T>
+size_t HeapBytes(const std::deque<T>& d) {
+  const size_t per_node = sizeof(T) < 512 ? 512 / sizeof(T) : 1;
+  const size_t nodes = d.size() / per_node + 1;
+  size_t result = nodes * per_node * sizeof(T) + std::max<size_t>(8, nodes + 2) * 8;
+  for (const auto& x : d) result += HeapBytes(x);
+  return result;
+}
+
+template <typename Payload, size_t N>
+size_t HeapBytes(const PayloadArray<Payload, N>& a) {
+  return HeapBytes(static_cast<const std::array<Payload, N>&>(a));
+}
+
+template <size_t N>
+size_t HeapBytes(const PayloadArray<NoPayload, N>&) {
+  return 0;
+}
+
+template <typename Payload>
+size_t HeapBytes(const PayloadVector<Payload>& v) {
+  return HeapBytes(static_cast<const std::vector<Payload>&>(v));
+}
+
+inline size_t HeapBytes(const PayloadVector<NoPayload>&) {
+  return 0;
+}
+
+struct ItemBudget {
+  template <typename T>
+  static size_t Cost(const T&) {
+    return 1;
+  }
+};
+
+struct ByteBudget {
+  template <typename T>
+  static size_t Cost(const T& key) {
+    return sizeof(T) + HeapBytes(key);
+  }
+};
@@ -0,0 +1,342 @@
+#include "benchmark.hpp"
+#include "kll.hpp"
+#include "reservoir.hpp"
+#include "sampled-kll.hpp"
+#include "sampler.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Times Insert, Merge and GetCdf on each sketch, and Step on each sampler, and reports
+// nanoseconds and heap allocations per operation, with a 95% confidence interval over
+// repetitions.
+//
+//   microbenchmark [--repetitions=N] [--keys=N] [--filter=TEXT] [--json=FILE]
+//
+// --filter runs only the benchmarks whose name contains TEXT. --json also writes every
+// result to FILE, for comparing releases.
+
+using namespace std;
+
+// Every allocation in the program goes through here, so a benchmark can count the
+// allocations made while it runs.
+static uint64_t allocations = 0;
+
+void* operator new(size_t size) {
+  ++allocations;
+  if (void* result = malloc(size ? size : 1)) return result;
+  throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// Benchmarks add their results here so the compiler cannot drop the work.
+static volatile uint64_t sink = 0;
+
+struct Options {
+  int repetitions = 10;
+  size_t keys = 100000;
+  string filter;
+  string json;
+};
+
+struct Result {
+  string name, op, subject, key_type, distribution;
+  int32_t capacity = 0;
+  uint64_t ops_per_repetition = 0;
+  Summary nanos_per_op;
+  double allocations_per_op = 0;
+};
+
+// Accumulates the time and allocations of the code it is started and stopped around.
+class Stopwatch {
+  chrono::steady_clock::time_point start_;
+  uint64_t start_allocations_ = 0;
+
+ public:
+  uint64_t nanos = 0, allocations = 0;
+
+  void Start() {
+    start_allocations_ = ::allocations;
+    start_ = chrono::steady_clock::now();
+  }
+
+  void Stop() {
+    const auto finish = chrono::steady_clock::now();
+    nanos += chrono::duration_cast<chrono::nanoseconds>(finish - start_).count();
+    allocations += ::allocations - start_allocations_;
+  }
+};
+
+// Runs repetition(&stopwatch) options.repetitions times after one warm-up run. Each
+// run must perform ops operations inside the stopwatch.
+template <typename F>
+void Measure(const Options& options, Result result, uint64_t ops, const F& repetition,
+    vector<Result>* results) {
+  {
+    Stopwatch warm_up;
+    repetition(&warm_up);
+  }
+  vector<double> samples;
+  uint64_t total_allocations = 0;
+  for (int i = 0; i < options.repetitions; ++i) {
+    Stopwatch stopwatch;
+    repetition(&stopwatch);
+    samples.push_back(static_cast<double>(stopwatch.nanos) / ops);
+    total_allocations += stopwatch.allocations;
+  }
+  result.ops_per_repetition = ops;
+  result.nanos_per_op = Summarize(samples);
+  result.allocations_per_op =
+      static_cast<double>(total_allocations) / (ops * options.repetitions);
+  const Summary& s = result.nanos_per_op;
+  cout << left << setw(48) << result.name << right << fixed << setprecision(2)
+       << setw(12) << s.mean << " ns/op +- " << setw(8) << s.ci95 << setw(10)
+       << result.allocations_per_op << " allocs/op" << endl;
+  results->push_back(result);
+}
+
+bool Selected(const Options& options, const string& name) {
+  return name.find(options.filter) != string::npos;
+}
+
+// Keys in the order of each input distribution. Zipf draws from 100000 values with
+// exponent 1.1, so a few values dominate.
+vector<uint64_t> Stream(const string& distribution, size_t count) {
+  mt19937_64 r(12345);
+  vector<uint64_t> result(count);
+  if (distribution == "zipf") {
+    vector<double> cdf(100000);
+    double total = 0;
+    for (size_t i = 0; i < cdf.size(); ++i) cdf[i] = total += pow(i + 1.0, -1.1);
+    uniform_real_distribution<double> u(0, total);
+    for (auto& key : result) {
+      key = lower_bound(cdf.begin(), cdf.end(), u(r)) - cdf.begin();
+      // Scatter the hot values over the key space.
+      key = key * 0x9e3779b97f4a7c15ull;
+    }
+    return result;
+  }
+  for (auto& key : result) key = r();
+  if (distribution == "sorted") sort(result.begin(), result.end());
+  if (distribution == "reversed") sort(result.rbegin(), result.rend());
+  return result;
+}
+
+template <typename T>
+T Key(uint64_t x);
+
+template <>
+uint64_t Key<uint64_t>(uint64_t x) {
+  return x;
+}
+
+template <>
+double Key<double>(uint64_t x) {
+  return static_cast<double>(x);
+}
+
+// Zero-padded, so strings sort in the same order as the numbers.
+template <>
+string Key<string>(uint64_t x) {
+  ostringstream out;
+  out << setw(20) << setfill('0') << x;
+  return out.str();
+}
+
+Result Describe(const string& op, const string& subject, const string& key_type,
+    int32_t capacity, const string& distribution) {
+  Result result;
+  result.op = op;
+  result.subject = subject;
+  result.key_type = key_type;
+  result.capacity = capacity;
+  result.distribution = distribution;
+  result.name = op + "/" + subject + "/" + key_type + "/" + to_string(capacity) + "/"
+      + distribution;
+  return result;
+}
+
+template <typename Sketch>
+unique_ptr<Sketch> Build(const vector<typename Sketch::Key>& keys, size_t begin,
+    size_t end, mt19937_64* r) {
+  auto sketch = make_unique<Sketch>();
+  for (size_t i = begin; i < end; ++i) sketch->Insert(r, keys[i], 0);
+  return sketch;
+}
+
+// Sketches are used through this wrapper so that Build knows their key type.
+template <typename T, typename S>
+struct Keyed : S {
+  using Key = T;
+};
+
+template <typename Sketch>
+void InsertBenchmark(const Options& options, Result result,
+    const vector<typename Sketch::Key>& keys, vector<Result>* results) {
+  if (!Selected(options, result.name)) return;
+  Measure(options, result, keys.size(), [&](Stopwatch* stopwatch) {
+    mt19937_64 r(1);
+    auto sketch = make_unique<Sketch>();
+    stopwatch->Start();
+    for (const auto& key : keys) sketch->Insert(&r, key, 0);
+    stopwatch->Stop();
+  }, results);
+}
+
+template <typename Sketch>
+void MergeBenchmark(const Options& options, Result result,
+    const vector<typename Sketch::Key>& keys, vector<Result>* results) {
+  if (!Selected(options, result.name)) return;
+  mt19937_64 r(2);
+  const auto left = Build<Sketch>(keys, 0, keys.size() / 2, &r);
+  const auto right = Build<Sketch>(keys, keys.size() / 2, keys.size(), &r);
+  constexpr uint64_t MERGES = 100;
+  Measure(options, result, MERGES, [&](Stopwatch* stopwatch) {
+    for (uint64_t i = 0; i < MERGES; ++i) {
+      auto target = make_unique<Sketch>(*left);
+      stopwatch->Start();
+      target->Merge(&r, *right);
+      stopwatch->Stop();
+    }
+  }, results);
+}
+
+template <typename Sketch>
+void QueryBenchmark(const Options& options, Result result,
+    const vector<typename Sketch::Key>& keys, vector<Result>* results) {
+  if (!Selected(options, result.name)) return;
+  mt19937_64 r(3);
+  const auto sketch = Build<Sketch>(keys, 0, keys.size(), &r);
+  constexpr uint64_t QUERIES = 100;
+  Measure(options, result, QUERIES, [&](Stopwatch* stopwatch) {
+    uint64_t checksum = 0;
+    stopwatch->Start();
+    for (uint64_t i = 0; i < QUERIES; ++i) {
+      checksum += sketch->GetCdf().GetValue(i % 100) == keys[0];
+    }
+    stopwatch->Stop();
+    sink = sink + checksum;
+  }, results);
+}
+
+template <typename T, int32_t N>
+void SketchBenchmarks(const string& key_type, const Options& options,
+    vector<Result>* results) {
+  using SampledKllT = Keyed<T, SampledKll<T, N>>;
+  using KllT = Keyed<T, Kll<T, N>>;
+  using ReservoirT = Keyed<T, Reservoir<T, N>>;
+  for (const string distribution : {"uniform", "sorted", "reversed", "zipf"}) {
+    const auto stream = Stream(distribution, options.keys);
+    vector<T> keys;
+    for (const auto x : stream) keys.push_back(Key<T>(x));
+    const auto describe = [&](const string& op, const string& subject) {
+      return Describe(op, subject, key_type, N, distribution);
+    };
+    InsertBenchmark<SampledKllT>(
+        options, describe("insert", "SampledKll"), keys, results);
+    InsertBenchmark<KllT>(options, describe("insert", "Kll"), keys, results);
+    InsertBenchmark<ReservoirT>(options, describe("insert", "Reservoir"), keys, results);
+    // Reservoir declares Merge but does not implement it.
+    MergeBenchmark<SampledKllT>(options, describe("merge", "SampledKll"), keys, results);
+    MergeBenchmark<KllT>(options, describe("merge", "Kll"), keys, results);
+    QueryBenchmark<SampledKllT>(options, describe("query", "SampledKll"), keys, results);
+    QueryBenchmark<KllT>(options, describe("query", "Kll"), keys, results);
+    QueryBenchmark<ReservoirT>(options, describe("query", "Reservoir"), keys, results);
+  }
+}
+
+// Samplers get cheaper per step as the stream grows, since Li and Vitter skip ahead, so
+// each one is timed over streams of several lengths.
+template <typename Sampler>
+void SamplerBenchmark(const string& subject, const Options& options,
+    vector<Result>* results) {
+  for (const uint64_t length : {1000, 1000000}) {
+    Result result =
+        Describe("step", subject, "uint64_t", 1, "length-" + to_string(length));
+    if (!Selected(options, result.name)) continue;
+    const uint64_t streams = max<uint64_t>(1, options.keys * 10 / length);
+    Measure(options, result, streams * length, [&](Stopwatch* stopwatch) {
+      mt19937_64 r(4);
+      uint64_t kept = 0;
+      stopwatch->Start();
+      for (uint64_t i = 0; i < streams; ++i) {
+        Sampler sampler;
+        for (uint64_t j = 0; j < length; ++j) kept += sampler.Step(&r);
+      }
+      stopwatch->Stop();
+      sink = sink + kept;
+    }, results);
+  }
+}
+
+void WriteJson(const string& filename, const vector<Result>& results) {
+  ofstream out(filename);
+  out << "{\n  \"context\": {\"compiler\": " << JsonString(__VERSION__)
+#ifdef NDEBUG
+      << ", \"ndebug\": true"
+#else
+      << ", \"ndebug\": false"
+#endif
+      << ", \"time\": " << chrono::duration_cast<chrono::seconds>(
+             chrono::system_clock::now().time_since_epoch()).count()
+      << "},\n  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    const Summary& s = r.nanos_per_op;
+    out << (i ? "," : "") << "\n    {\"name\": " << JsonString(r.name)
+        << ", \"op\": " << JsonString(r.op) << ", \"subject\": " << JsonString(r.subject)
+        << ", \"key_type\": " << JsonString(r.key_type)
+        << ", \"capacity\": " << r.capacity
+        << ", \"distribution\": " << JsonString(r.distribution)
+        << ", \"ops_per_repetition\": " << r.ops_per_repetition
+        << ", \"repetitions\": " << s.count << ", \"ns_per_op\": {\"mean\": " << s.mean
+        << ", \"stddev\": " << s.stddev << ", \"ci95\": " << s.ci95
+        << ", \"min\": " << s.min << ", \"max\": " << s.max
+        << "}, \"allocations_per_op\": " << r.allocations_per_op << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const string arg = argv[i];
+    const auto value = [&](const char* flag) { return FlagValue(arg, flag); };
+    if (!value("--repetitions=").empty()) {
+      options.repetitions = StringCast<int>(value("--repetitions="));
+    } else if (!value("--keys=").empty()) {
+      options.keys = StringCast<size_t>(value("--keys="));
+    } else if (!value("--filter=").empty()) {
+      options.filter = value("--filter=");
+    } else if (!value("--json=").empty()) {
+      options.json = value("--json=");
+    } else {
+      return UsageError("unknown argument " + arg);
+    }
+  }
+  // No repetitions would leave every mean undefined and the JSON output invalid.
+  if (options.repetitions < 1) return UsageError("--repetitions must be at least 1");
+  vector<Result> results;
+  SketchBenchmarks<uint64_t, 200>("uint64_t", options, &results);
+  SketchBenchmarks<uint64_t, 2000>("uint64_t", options, &results);
+  SketchBenchmarks<double, 2000>("double", options, &results);
+  SketchBenchmarks<string, 200>("string", options, &results);
+  SketchBenchmarks<string, 2000>("string", options, &results);
+  SamplerBenchmark<sampler::Simple<uint64_t>>("Simple", options, &results);
+  SamplerBenchmark<sampler::Li<uint64_t>>("Li", options, &results);
+  SamplerBenchmark<sampler::Vitter<uint64_t>>("Vitter", options, &results);
+  if (!options.json.empty()) WriteJson(options.json, results);
+}
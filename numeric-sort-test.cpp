@@ -0,0 +1,67 @@
+#include "numeric-sort.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace numeric_sort;
+
+// Checks every kernel available for T against std::sort, on lengths around the register
+// widths and thresholds, with random bits, few distinct keys, shared high bytes, and
+// the extremes of T, infinities included, which must not lose to padding.
+template <typename T>
+void Check(const char* name) {
+  using Limits = numeric_limits<T>;
+  const T greatest = Limits::has_infinity ? Limits::infinity() : Limits::max();
+  const T extremes[] = {Limits::lowest(), Limits::max(), T(0), greatest, T(-greatest)};
+  mt19937_64 r(1);
+  for (const size_t size : {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 64, 65,
+           100, 129, 333, 1000, 1024, 1025, 2049, 5000, 70000}) {
+    for (int pattern = 0; pattern < 4; ++pattern) {
+      vector<T> keys(size);
+      for (auto& key : keys) {
+        uint64_t bits = r();
+        if (pattern == 1) bits %= 7;
+        if (pattern == 2) bits &= 0xFF00FF;
+        memcpy(&key, &bits, sizeof(key));
+        if (key != key) key = 0;
+        if (pattern == 3) key = extremes[bits % 5];
+      }
+      vector<T> expected = keys;
+      sort(expected.begin(), expected.end());
+      for (const auto kernel : {Kernel::STD, Kernel::RADIX, Kernel::SCALAR_NETWORK,
+               Kernel::SSE2_NETWORK, Kernel::AVX2_NETWORK}) {
+        if (!Available<T>(kernel)) continue;
+        vector<T> actual = keys;
+        Sort(actual.data(), actual.data() + size, kernel);
+        // -0.0 and 0.0 compare equal, but radix sort orders them.
+        if (actual != expected) {
+          cerr << name << ' ' << KernelName(kernel) << " failed on " << size << " keys"
+               << endl;
+          exit(1);
+        }
+      }
+    }
+  }
+  cout << "OK " << name << endl;
+}
+
+int main() {
+  Check<float>("float");
+  Check<double>("double");
+  Check<int32_t>("int32_t");
+  Check<uint32_t>("uint32_t");
+  Check<int64_t>("int64_t");
+  Check<uint64_t>("uint64_t");
+  Check<long long>("long long");
+  Check<int16_t>("int16_t");
+  Check<char>("char");
+  vector<string> words = {"b", "c", "a"};
+  Sort(words.data(), words.data() + words.size());
+  if (words != vector<string>{"a", "b", "c"}) return 1;
+  cout << "OK string" << endl;
+}
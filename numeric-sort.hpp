@@ -0,0 +1,467 @@
+#pragma once
+
+/// Sorting kernels for the sketches' compaction paths.
+///
+/// numeric_sort::Sort(first, last) sorts a range of keys. For arithmetic key types it
+/// picks a kernel by the length of the range and the CPU it runs on:
+///
+///  1. for short ranges, a bitonic sorting network and SIMD merge (sorting-network.hpp),
+///     using AVX2 if the CPU supports it and SSE2 otherwise,
+///  2. for longer ranges, an LSD radix sort over bytes that skips the bytes all keys
+///     share, and
+///  3. std::sort for the shortest ranges of types with no vector kernel.
+///
+/// Other key types always use std::sort. Floating-point keys must not be NaN. The
+/// kernels can also be called one at a time; sort-benchmark.cpp times each of them
+/// against std::sort, and the thresholds below come from its results.
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NUMERIC_SORT_X86 1
+#endif
+
+namespace numeric_sort {
+
+enum struct Kernel { STD, RADIX, SCALAR_NETWORK, SSE2_NETWORK, AVX2_NETWORK };
+
+static constexpr const char* KernelName(Kernel kernel) {
+  return (kernel == Kernel::STD) ? "std::sort" :
+      (kernel == Kernel::RADIX) ? "radix" :
+      (kernel == Kernel::SCALAR_NETWORK) ? "scalar network" :
+      (kernel == Kernel::SSE2_NETWORK) ? "SSE2 network" : "AVX2 network";
+}
+
+// RadixKey<T>::Encode maps keys to unsigned integers of the same size that sort in the
+// same order.
+template <typename T, typename Enable = void>
+struct RadixKey {
+  static constexpr bool ENABLED = false;
+};
+
+template <typename T>
+struct RadixKey<T, std::enable_if_t<std::is_integral<T>::value
+    && !std::is_same<T, bool>::value && sizeof(T) <= 8>> {
+  static constexpr bool ENABLED = true;
+  using Bits = std::make_unsigned_t<T>;
+  static Bits Encode(T key) {
+    // Flipping the sign bit puts negative keys before the others.
+    constexpr Bits SIGN = std::is_signed<T>::value ? Bits(1) << (8 * sizeof(T) - 1) : 0;
+    return static_cast<Bits>(key) ^ SIGN;
+  }
+};
+
+template <typename T>
+struct RadixKey<T, std::enable_if_t<std::is_floating_point<T>::value
+    && (sizeof(T) == 4 || sizeof(T) == 8)>> {
+  static constexpr bool ENABLED = true;
+  using Bits = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+  static Bits Encode(T key) {
+    Bits bits;
+    std::memcpy(&bits, &key, sizeof(bits));
+    // Negative keys grow as their magnitude shrinks, so all of their bits are flipped.
+    constexpr Bits SIGN = Bits(1) << (8 * sizeof(T) - 1);
+    return (bits & SIGN) ? ~bits : (bits | SIGN);
+  }
+};
+
+template <typename T>
+void RadixSort(T* first, T* last) {
+  using Key = RadixKey<T>;
+  static_assert(Key::ENABLED, "radix sort needs integer or floating-point keys");
+  constexpr int BYTES = sizeof(T);
+  const size_t size = last - first;
+  if (size < 2) return;
+  assert(size <= std::numeric_limits<uint32_t>::max());
+  std::array<std::array<uint32_t, 256>, BYTES> counts{};
+  for (const T* i = first; i != last; ++i) {
+    const auto bits = Key::Encode(*i);
+    for (int b = 0; b < BYTES; ++b) ++counts[b][(bits >> (8 * b)) & 0xFF];
+  }
+  thread_local std::vector<T> scratch;
+  if (scratch.size() < size) scratch.resize(size);
+  T* from = first;
+  T* to = scratch.data();
+  const auto head = Key::Encode(*first);
+  for (int b = 0; b < BYTES; ++b) {
+    auto& count = counts[b];
+    // A byte that every key shares would leave the keys where they are.
+    if (count[(head >> (8 * b)) & 0xFF] == size) continue;
+    uint32_t offset = 0;
+    for (auto& c : count) {
+      const uint32_t bucket = c;
+      c = offset;
+      offset += bucket;
+    }
+    for (const T* i = from; i != from + size; ++i) {
+      to[count[(Key::Encode(*i) >> (8 * b)) & 0xFF]++] = *i;
+    }
+    std::swap(from, to);
+  }
+  if (from != first) std::copy(from, from + size, first);
+}
+
+// One key per "register", which turns the network sort into a branch-light merge sort.
+// It serves as the fallback for key types and targets with no vector kernel.
+namespace scalar {
+#include "sorting-network.hpp"
+
+template <typename Key>
+struct Traits {
+  static constexpr bool ENABLED = std::is_arithmetic<Key>::value;
+  using T = Key;
+  using V = Key;
+  static constexpr int LANES = 1;
+  static V Load(const T* p) { return *p; }
+  static void Store(T* p, V v) { *p = v; }
+  static V Min(V a, V b) { return (b < a) ? b : a; }
+  static V Max(V a, V b) { return (a < b) ? b : a; }
+  static V Reverse(V v) { return v; }
+  // Infinity, as the vector kernels pad with, for floating point: max() sorts below it.
+  static T Greatest() {
+    return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity()
+                                                : std::numeric_limits<T>::max();
+  }
+};
+}  // namespace scalar
+
+#ifdef __SSE2__
+namespace sse2 {
+#include "sorting-network.hpp"
+
+template <typename Key>
+struct Traits {
+  static constexpr bool ENABLED = false;
+};
+
+// SSE2 has no blend instruction, so Blend selects lanes with a mask of all-zero and
+// all-one lanes.
+template <>
+struct Traits<float> {
+  static constexpr bool ENABLED = true;
+  using T = float;
+  using V = __m128;
+  static constexpr int LANES = 4;
+  static V Load(const T* p) { return _mm_loadu_ps(p); }
+  static void Store(T* p, V v) { _mm_storeu_ps(p, v); }
+  static V Min(V a, V b) { return _mm_min_ps(a, b); }
+  static V Max(V a, V b) { return _mm_max_ps(a, b); }
+  static V Exchange(V v, std::integral_constant<int, 1>) {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+  }
+  static V Exchange(V v, std::integral_constant<int, 2>) {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2));
+  }
+  template <int MASK>
+  static V Blend(V a, V b) {
+    const V mask = _mm_castsi128_ps(_mm_setr_epi32(-(MASK & 1), -((MASK >> 1) & 1),
+        -((MASK >> 2) & 1), -((MASK >> 3) & 1)));
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+  }
+  static V Reverse(V v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3)); }
+  static T Greatest() { return std::numeric_limits<T>::infinity(); }
+};
+
+template <>
+struct Traits<double> {
+  static constexpr bool ENABLED = true;
+  using T = double;
+  using V = __m128d;
+  static constexpr int LANES = 2;
+  static V Load(const T* p) { return _mm_loadu_pd(p); }
+  static void Store(T* p, V v) { _mm_storeu_pd(p, v); }
+  static V Min(V a, V b) { return _mm_min_pd(a, b); }
+  static V Max(V a, V b) { return _mm_max_pd(a, b); }
+  static V Exchange(V v, std::integral_constant<int, 1>) {
+    return _mm_shuffle_pd(v, v, 1);
+  }
+  template <int MASK>
+  static V Blend(V a, V b) {
+    const V mask = _mm_castsi128_pd(_mm_set_epi64x(-((MASK >> 1) & 1), -(MASK & 1)));
+    return _mm_or_pd(_mm_and_pd(mask, b), _mm_andnot_pd(mask, a));
+  }
+  static V Reverse(V v) { return _mm_shuffle_pd(v, v, 1); }
+  static T Greatest() { return std::numeric_limits<T>::infinity(); }
+};
+}  // namespace sse2
+#endif  // __SSE2__
+
+#ifdef NUMERIC_SORT_X86
+// Everything in this namespace is compiled for AVX2, so it may only run after
+// HasAvx2() returns true.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+namespace avx2 {
+#include "sorting-network.hpp"
+
+struct Float {
+  static constexpr bool ENABLED = true;
+  using T = float;
+  using V = __m256;
+  static constexpr int LANES = 8;
+  static V Load(const T* p) { return _mm256_loadu_ps(p); }
+  static void Store(T* p, V v) { _mm256_storeu_ps(p, v); }
+  static V Min(V a, V b) { return _mm256_min_ps(a, b); }
+  static V Max(V a, V b) { return _mm256_max_ps(a, b); }
+  static V Exchange(V v, std::integral_constant<int, 1>) {
+    return _mm256_permute_ps(v, _MM_SHUFFLE(2, 3, 0, 1));
+  }
+  static V Exchange(V v, std::integral_constant<int, 2>) {
+    return _mm256_permute_ps(v, _MM_SHUFFLE(1, 0, 3, 2));
+  }
+  static V Exchange(V v, std::integral_constant<int, 4>) {
+    return _mm256_permute2f128_ps(v, v, 1);
+  }
+  template <int MASK>
+  static V Blend(V a, V b) { return _mm256_blend_ps(a, b, MASK); }
+  static V Reverse(V v) {
+    return Exchange(_mm256_permute_ps(v, _MM_SHUFFLE(0, 1, 2, 3)),
+        std::integral_constant<int, 4>());
+  }
+  static T Greatest() { return std::numeric_limits<T>::infinity(); }
+};
+
+struct Double {
+  static constexpr bool ENABLED = true;
+  using T = double;
+  using V = __m256d;
+  static constexpr int LANES = 4;
+  static V Load(const T* p) { return _mm256_loadu_pd(p); }
+  static void Store(T* p, V v) { _mm256_storeu_pd(p, v); }
+  static V Min(V a, V b) { return _mm256_min_pd(a, b); }
+  static V Max(V a, V b) { return _mm256_max_pd(a, b); }
+  static V Exchange(V v, std::integral_constant<int, 1>) {
+    return _mm256_permute_pd(v, 5);
+  }
+  static V Exchange(V v, std::integral_constant<int, 2>) {
+    return _mm256_permute2f128_pd(v, v, 1);
+  }
+  template <int MASK>
+  static V Blend(V a, V b) { return _mm256_blend_pd(a, b, MASK); }
+  static V Reverse(V v) { return _mm256_permute4x64_pd(v, _MM_SHUFFLE(0, 1, 2, 3)); }
+  static T Greatest() { return std::numeric_limits<T>::infinity(); }
+};
+
+template <typename Key>
+struct Int32 {
+  static constexpr bool ENABLED = true;
+  using T = Key;
+  using V = __m256i;
+  static constexpr int LANES = 8;
+  static V Load(const T* p) { return _mm256_loadu_si256(reinterpret_cast<const V*>(p)); }
+  static void Store(T* p, V v) { _mm256_storeu_si256(reinterpret_cast<V*>(p), v); }
+  static V Min(V a, V b) {
+    return std::is_signed<T>::value ? _mm256_min_epi32(a, b) : _mm256_min_epu32(a, b);
+  }
+  static V Max(V a, V b) {
+    return std::is_signed<T>::value ? _mm256_max_epi32(a, b) : _mm256_max_epu32(a, b);
+  }
+  static V Exchange(V v, std::integral_constant<int, 1>) {
+    return _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+  }
+  static V Exchange(V v, std::integral_constant<int, 2>) {
+    return _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+  }
+  static V Exchange(V v, std::integral_constant<int, 4>) {
+    return _mm256_permute2x128_si256(v, v, 1);
+  }
+  template <int MASK>
+  static V Blend(V a, V b) { return _mm256_blend_epi32(a, b, MASK); }
+  static V Reverse(V v) {
+    return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+  }
+  static T Greatest() { return std::numeric_limits<T>::max(); }
+};
+
+// AVX2 has no 64-bit minimum or maximum, so they are built from a signed comparison,
+// with the sign bits flipped first for unsigned keys.
+template <typename Key>
+struct Int64 {
+  static constexpr bool ENABLED = true;
+  using T = Key;
+  using V = __m256i;
+  static constexpr int LANES = 4;
+  static V Load(const T* p) { return _mm256_loadu_si256(reinterpret_cast<const V*>(p)); }
+  static void Store(T* p, V v) { _mm256_storeu_si256(reinterpret_cast<V*>(p), v); }
+  static V Greater(V a, V b) {
+    if (std::is_signed<T>::value) return _mm256_cmpgt_epi64(a, b);
+    const V sign = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+    return _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+  }
+  static V Min(V a, V b) { return _mm256_blendv_epi8(a, b, Greater(a, b)); }
+  static V Max(V a, V b) { return _mm256_blendv_epi8(b, a, Greater(a, b)); }
+  static V Exchange(V v, std::integral_constant<int, 1>) {
+    return _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+  }
+  static V Exchange(V v, std::integral_constant<int, 2>) {
+    return _mm256_permute2x128_si256(v, v, 1);
+  }
+  // Each 64-bit lane is two 32-bit lanes of the blend.
+  static constexpr int WideMask(int mask) {
+    return ((mask & 1) ? 0x3 : 0) | ((mask & 2) ? 0xC : 0) | ((mask & 4) ? 0x30 : 0)
+        | ((mask & 8) ? 0xC0 : 0);
+  }
+  template <int MASK>
+  static V Blend(V a, V b) {
+    constexpr int WIDE_MASK = WideMask(MASK);
+    return _mm256_blend_epi32(a, b, WIDE_MASK);
+  }
+  static V Reverse(V v) { return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(0, 1, 2, 3)); }
+  static T Greatest() { return std::numeric_limits<T>::max(); }
+};
+
+template <typename Key, typename Enable = void>
+struct Traits {
+  static constexpr bool ENABLED = false;
+};
+
+template <>
+struct Traits<float> : Float {};
+
+template <>
+struct Traits<double> : Double {};
+
+template <typename Key>
+struct Traits<Key, std::enable_if_t<std::is_integral<Key>::value && sizeof(Key) == 4>>
+    : Int32<Key> {};
+
+template <typename Key>
+struct Traits<Key, std::enable_if_t<std::is_integral<Key>::value && sizeof(Key) == 8>>
+    : Int64<Key> {};
+}  // namespace avx2
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif  // NUMERIC_SORT_X86
+
+inline bool HasAvx2() {
+#ifdef NUMERIC_SORT_X86
+  static const bool result = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }();
+  return result;
+#else
+  return false;
+#endif
+}
+
+template <typename T>
+bool Available(Kernel kernel) {
+  switch (kernel) {
+    case Kernel::STD: return true;
+    case Kernel::RADIX: return RadixKey<T>::ENABLED;
+    case Kernel::SCALAR_NETWORK: return scalar::Traits<T>::ENABLED;
+#ifdef __SSE2__
+    case Kernel::SSE2_NETWORK: return sse2::Traits<T>::ENABLED;
+#endif
+#ifdef NUMERIC_SORT_X86
+    case Kernel::AVX2_NETWORK: return avx2::Traits<T>::ENABLED && HasAvx2();
+#endif
+    default: return false;
+  }
+}
+
+// Each kernel comes with an overload for types it does not support, so that Sort()
+// compiles for every T; Available() keeps those overloads from being chosen.
+template <typename T>
+void RadixKernel(T* first, T* last, std::true_type) { RadixSort(first, last); }
+
+template <typename T>
+void ScalarKernel(T* first, T* last, std::true_type) {
+  scalar::Sort<scalar::Traits<T>>(first, last);
+}
+
+#ifdef __SSE2__
+template <typename T>
+void Sse2Kernel(T* first, T* last, std::true_type) {
+  sse2::Sort<sse2::Traits<T>>(first, last);
+}
+#endif
+
+#ifdef NUMERIC_SORT_X86
+template <typename T>
+void Avx2Kernel(T* first, T* last, std::true_type) {
+  avx2::Sort<avx2::Traits<T>>(first, last);
+}
+#endif
+
+template <typename T>
+void RadixKernel(T* first, T* last, std::false_type) { std::sort(first, last); }
+
+template <typename T>
+void ScalarKernel(T* first, T* last, std::false_type) { std::sort(first, last); }
+
+template <typename T>
+void Sse2Kernel(T* first, T* last, std::false_type) { std::sort(first, last); }
+
+template <typename T>
+void Avx2Kernel(T* first, T* last, std::false_type) { std::sort(first, last); }
+
+template <typename T>
+void Sort(T* first, T* last, Kernel kernel) {
+  assert(Available<T>(kernel));
+  switch (kernel) {
+    case Kernel::RADIX:
+      RadixKernel(first, last, std::integral_constant<bool, RadixKey<T>::ENABLED>());
+      return;
+    case Kernel::SCALAR_NETWORK:
+      ScalarKernel(
+          first, last, std::integral_constant<bool, scalar::Traits<T>::ENABLED>());
+      return;
+#ifdef __SSE2__
+    case Kernel::SSE2_NETWORK:
+      Sse2Kernel(first, last, std::integral_constant<bool, sse2::Traits<T>::ENABLED>());
+      return;
+#endif
+#ifdef NUMERIC_SORT_X86
+    case Kernel::AVX2_NETWORK:
+      Avx2Kernel(first, last, std::integral_constant<bool, avx2::Traits<T>::ENABLED>());
+      return;
+#endif
+    default:
+      std::sort(first, last);
+  }
+}
+
+// The longest ranges for which the network kernels beat radix sort, by key size, and
+// the shortest range for which radix sort beats std::sort. The scalar network is never
+// faster than std::sort, so it is only there as a baseline.
+static constexpr size_t AVX2_NETWORK_LIMIT[2] = {1024, 128},
+                        SSE2_NETWORK_LIMIT[2] = {128, 64}, RADIX_MINIMUM = 64;
+
+template <typename T>
+Kernel Choose(size_t size) {
+  if (!std::is_arithmetic<T>::value) return Kernel::STD;
+  const int wide = sizeof(T) > 4;
+  if (size <= AVX2_NETWORK_LIMIT[wide] && Available<T>(Kernel::AVX2_NETWORK)) {
+    return Kernel::AVX2_NETWORK;
+  }
+  if (size <= SSE2_NETWORK_LIMIT[wide] && Available<T>(Kernel::SSE2_NETWORK)) {
+    return Kernel::SSE2_NETWORK;
+  }
+  if (size >= RADIX_MINIMUM && Available<T>(Kernel::RADIX)) return Kernel::RADIX;
+  return Kernel::STD;
+}
+
+template <typename T>
+void Sort(T* first, T* last) {
+  Sort(first, last, Choose<T>(last - first));
+}
+
+}  // namespace numeric_sort
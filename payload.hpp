@@ -0,0 +1,107 @@
+#pragma once
+
+/// Optional payloads that sketches carry alongside their keys.
+///
+/// A payload, such as a trace ID, moves with its key through compaction and merges, so a
+/// quantile can be reported with an exemplar, but it never takes part in comparisons.
+/// Sketches keep payloads in a column parallel to their keys instead of in pairs, so
+/// sorts compare only keys and move each payload once, after the keys are in order.
+/// NoPayload, the default, stores nothing.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "numeric-sort.hpp"
+
+struct NoPayload {
+  // Every NoPayload column hands out this one, so the columns themselves are empty.
+  static NoPayload& None() {
+    static NoPayload none;
+    return none;
+  }
+};
+
+template <typename Payload, size_t N>
+struct PayloadArray : std::array<Payload, N> {};
+
+template <size_t N>
+struct PayloadArray<NoPayload, N> {
+  NoPayload& operator[](size_t) { return NoPayload::None(); }
+  const NoPayload& operator[](size_t) const { return NoPayload::None(); }
+};
+
+template <typename Payload>
+struct PayloadVector : std::vector<Payload> {};
+
+template <>
+struct PayloadVector<NoPayload> {
+  void push_back(const NoPayload&) {}
+  void clear() {}
+  void resize(size_t) {}
+  NoPayload& operator[](size_t) { return NoPayload::None(); }
+  const NoPayload& operator[](size_t) const { return NoPayload::None(); }
+};
+
+// Copies from[begin, begin + count) to (*to)[dest, dest + count), in the order of
+// std::copy, so from and to may be the same column if dest <= begin. For NoPayload
+// columns this compiles to nothing.
+template <typename From, typename To>
+void CopyPayloads(const From& from, size_t begin, size_t count, To* to, size_t dest) {
+  for (size_t i = 0; i < count; ++i) (*to)[dest + i] = from[begin + i];
+}
+
+template <typename T, typename Payloads>
+void SortWithPayloads(T* keys, size_t size, Payloads*, size_t, uint64_t* comparisons,
+    std::true_type) {
+  if (comparisons == nullptr) {
+    numeric_sort::Sort(keys, keys + size);
+    return;
+  }
+  std::sort(keys, keys + size, [comparisons](const T& x, const T& y) {
+    ++*comparisons;
+    return x < y;
+  });
+}
+
+template <typename T, typename Payloads>
+void SortWithPayloads(T* keys, size_t size, Payloads* payloads, size_t offset,
+    uint64_t* comparisons, std::false_type) {
+  using Payload = std::decay_t<decltype((*payloads)[0])>;
+  thread_local std::vector<uint32_t> order;
+  order.resize(size);
+  std::iota(order.begin(), order.end(), 0);
+  uint64_t count = 0;
+  std::sort(order.begin(), order.end(), [keys, &count](uint32_t x, uint32_t y) {
+    ++count;
+    return keys[x] < keys[y];
+  });
+  if (comparisons != nullptr) *comparisons += count;
+  std::vector<T> sorted_keys;
+  std::vector<Payload> sorted_payloads;
+  sorted_keys.reserve(size);
+  sorted_payloads.reserve(size);
+  for (const uint32_t i : order) {
+    sorted_keys.push_back(std::move(keys[i]));
+    sorted_payloads.push_back(std::move((*payloads)[offset + i]));
+  }
+  std::move(sorted_keys.begin(), sorted_keys.end(), keys);
+  for (size_t i = 0; i < size; ++i) {
+    (*payloads)[offset + i] = std::move(sorted_payloads[i]);
+  }
+}
+
+// Sorts keys[0, size) and moves (*payloads)[offset, offset + size) to match. If
+// comparisons is not null, adds the number of key comparisons to it; this needs a
+// comparison sort, so it bypasses the numeric kernels.
+template <typename T, typename Payloads>
+void SortWithPayloads(T* keys, size_t size, Payloads* payloads, size_t offset,
+    uint64_t* comparisons = nullptr) {
+  using Payload = std::decay_t<decltype((*payloads)[0])>;
+  SortWithPayloads(
+      keys, size, payloads, offset, comparisons, std::is_same<Payload, NoPayload>());
+}
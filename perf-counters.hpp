@@ -0,0 +1,232 @@
+#pragma once
+
+/// Hardware performance counters for phases of a driver.
+///
+/// PerfCounters opens one perf_event_open counter per event for the calling thread:
+/// cycles, instructions, L1 data cache read misses, last-level cache misses and branch
+/// misses, plus task-clock time and page faults from the kernel's software counters.
+/// Every Start()/Stop() pair adds to the totals, so a phase that runs many times, such
+/// as each trial's ingest, is reported as a whole.
+///
+/// Counters only count user-space events, which perf_event_paranoid allows up to 2.
+/// An event the kernel refuses, for instance in a virtual machine without a PMU, under
+/// a stricter paranoid setting, or on a system other than Linux, is left out of reports
+/// after one warning on stderr, and the rest still work. If the kernel multiplexes
+/// counters, each Start()/Stop() pair's count is scaled up by the fraction of that
+/// interval in which the counter ran.
+///
+/// Counters that run out of file descriptors throw rather than leave events out, since
+/// the totals would then silently miss the threads that could not count. A driver that
+/// counts on many threads keeps one PerfCounters per thread and moves what each phase
+/// counted into PerfCounters(false), which opens nothing and only holds totals.
+///
+/// ScopedProfiler counts from its construction to its destruction and then prints one
+/// line with the elapsed time and every available counter.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class PerfCounters {
+ public:
+  enum Event {
+    CYCLES,
+    INSTRUCTIONS,
+    L1D_MISSES,
+    LLC_MISSES,
+    BRANCH_MISSES,
+    TASK_CLOCK_NS,
+    PAGE_FAULTS,
+    EVENTS
+  };
+
+  static const char* Name(int event) {
+    static const char* const NAMES[EVENTS] = {"cycles", "instructions", "L1d-misses",
+        "LLC-misses", "branch-misses", "task-ns", "page-faults"};
+    return NAMES[event];
+  }
+
+ private:
+  std::array<int, EVENTS> fds_;
+  std::array<bool, EVENTS> available_{};
+  std::array<uint64_t, EVENTS> totals_{};
+  std::chrono::steady_clock::duration elapsed_{};
+  std::chrono::steady_clock::time_point start_;
+  // What Start() read from each counter: its count, the time it had been enabled and
+  // the time it had run. Resetting a counter zeroes only the count, so Stop() scales by
+  // the times since Start() rather than since the counter was opened.
+  std::array<std::array<uint64_t, 3>, EVENTS> started_{};
+
+#ifdef __linux__
+  static bool Read(int fd, std::array<uint64_t, 3>* values) {
+    const ssize_t size = sizeof(uint64_t) * values->size();
+    return read(fd, values->data(), size) == size;
+  }
+
+  static int Open(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    const int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+      throw std::runtime_error("no file descriptors left for performance counters");
+    }
+    return fd;
+  }
+
+  static uint64_t CacheMisses(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  }
+#endif
+
+ public:
+  PerfCounters() : PerfCounters(true) {}
+
+  // Unless open, opens nothing, and holds only what Add() adds.
+  explicit PerfCounters(bool open) {
+    fds_.fill(-1);
+    if (!open) return;
+#ifdef __linux__
+    try {
+      fds_[CYCLES] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+      fds_[INSTRUCTIONS] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+      fds_[L1D_MISSES] = Open(PERF_TYPE_HW_CACHE, CacheMisses(PERF_COUNT_HW_CACHE_L1D));
+      fds_[LLC_MISSES] = Open(PERF_TYPE_HW_CACHE, CacheMisses(PERF_COUNT_HW_CACHE_LL));
+      fds_[BRANCH_MISSES] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+      fds_[TASK_CLOCK_NS] = Open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+      fds_[PAGE_FAULTS] = Open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+    } catch (...) {
+      for (const int fd : fds_) {
+        if (fd >= 0) close(fd);
+      }
+      throw;
+    }
+#endif
+    std::string missing;
+    for (int event = 0; event < EVENTS; ++event) {
+      available_[event] = fds_[event] >= 0;
+      if (!Available(event)) missing = missing + ' ' + Name(event);
+    }
+    // Worker threads construct counters concurrently, and only one of them warns.
+    static std::atomic<bool> warned(false);
+    if (missing.empty() || warned.exchange(true)) return;
+    std::cerr << "performance counters unavailable:" << missing << std::endl;
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (const int fd : fds_) {
+      if (fd >= 0) close(fd);
+    }
+#endif
+  }
+
+  bool Available(int event) const { return available_[event]; }
+  uint64_t Total(int event) const { return totals_[event]; }
+  std::chrono::steady_clock::duration Elapsed() const { return elapsed_; }
+
+  void Start() {
+#ifdef __linux__
+    for (int event = 0; event < EVENTS; ++event) {
+      if (fds_[event] < 0) continue;
+      ioctl(fds_[event], PERF_EVENT_IOC_RESET, 0);
+      if (!Read(fds_[event], &started_[event])) started_[event].fill(0);
+      ioctl(fds_[event], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  void Stop() {
+    elapsed_ += std::chrono::steady_clock::now() - start_;
+#ifdef __linux__
+    for (int event = 0; event < EVENTS; ++event) {
+      if (fds_[event] < 0) continue;
+      ioctl(fds_[event], PERF_EVENT_IOC_DISABLE, 0);
+      std::array<uint64_t, 3> values;
+      if (!Read(fds_[event], &values)) continue;
+      uint64_t count = values[0] - started_[event][0];
+      const uint64_t enabled = values[1] - started_[event][1];
+      const uint64_t running = values[2] - started_[event][2];
+      if (running > 0 && running < enabled) {
+        count = static_cast<uint64_t>(static_cast<double>(count) * enabled / running);
+      }
+      totals_[event] += count;
+    }
+#endif
+  }
+
+  // Adds the totals of counters for the same events, for instance in another thread.
+  void Add(const PerfCounters& that) {
+    for (int event = 0; event < EVENTS; ++event) {
+      totals_[event] += that.totals_[event];
+      available_[event] = available_[event] || that.available_[event];
+    }
+    elapsed_ += that.elapsed_;
+  }
+
+  // Zeroes the totals, keeping the counters open.
+  void Clear() {
+    totals_.fill(0);
+    elapsed_ = {};
+  }
+
+  // One line: the elapsed milliseconds, then each available counter, then instructions
+  // per cycle if both are available. Totals are divided by runs, to report the mean of
+  // a phase that ran several times.
+  std::string Report(uint64_t runs = 1) const {
+    std::ostringstream out;
+    out << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed_).count() / runs
+        << " ms";
+    for (int event = 0; event < EVENTS; ++event) {
+      if (Available(event)) out << ", " << Name(event) << ' ' << totals_[event] / runs;
+    }
+    if (Available(CYCLES) && Available(INSTRUCTIONS) && totals_[CYCLES] > 0) {
+      out << ", IPC " << std::fixed << std::setprecision(2)
+          << static_cast<double>(totals_[INSTRUCTIONS]) / totals_[CYCLES];
+    }
+    return out.str();
+  }
+};
+
+class ScopedProfiler {
+  std::string phase_;
+  std::ostream* out_;
+  PerfCounters counters_;
+
+ public:
+  explicit ScopedProfiler(std::string phase, std::ostream* out = &std::cout)
+      : phase_(std::move(phase)), out_(out) {
+    counters_.Start();
+  }
+
+  ~ScopedProfiler() {
+    counters_.Stop();
+    *out_ << phase_ << ": " << counters_.Report() << std::endl;
+  }
+};
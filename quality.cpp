@@ -1,15 +1,56 @@
-#include "utility.hpp"
+#include "quality.hpp"
+#include "front-coded-kll.hpp"
 #include "kll.hpp"
 #include "reservoir.hpp"
+#include "run-length-kll.hpp"
 #include "sampled-kll.hpp"
 
+// Measures the accuracy of several sketches on the keys in FILE.
+//
+//   quality FILE [--trials=N] [--ci95=PERCENTILES] [--threads=N] [--batch=N]
+//       [--seed=N] [--percentiles=P,P,...] [--csv=FILE] [--json=FILE]
+//
+// --trials=0 runs until --ci95 is reached, or forever without it.
+
 using namespace std;
 
 int main(int argc, char ** argv) {
-  assert (argc == 2);
+  if (argc < 2) return UsageError("usage: quality FILE [--trials=N] ...");
+  QualityOptions options;
+  for (int i = 2; i < argc; ++i) {
+    const string arg = argv[i];
+    const auto value = [&](const char* flag) { return FlagValue(arg, flag); };
+    if (!value("--trials=").empty()) {
+      options.max_trials = StringCast<uint64_t>(value("--trials="));
+    } else if (!value("--ci95=").empty()) {
+      options.target_ci95 = StringCast<double>(value("--ci95="));
+    } else if (!value("--threads=").empty()) {
+      options.threads = max(1u, StringCast<unsigned>(value("--threads=")));
+    } else if (!value("--batch=").empty()) {
+      options.batch = StringCast<uint64_t>(value("--batch="));
+    } else if (!value("--seed=").empty()) {
+      options.seed = StringCast<uint64_t>(value("--seed="));
+    } else if (!value("--percentiles=").empty()) {
+      istringstream list(value("--percentiles="));
+      string p;
+      while (getline(list, p, ',')) options.percentiles.push_back(StringCast<double>(p));
+    } else if (!value("--csv=").empty()) {
+      options.csv = value("--csv=");
+    } else if (!value("--json=").empty()) {
+      options.json = value("--json=");
+    } else {
+      return UsageError("unknown argument " + arg);
+    }
+  }
   //InteractiveTest<UrandomBool, SampledKll<string, 1000>>(argv[1]);
   //InteractiveTest<UrandomBool, SampledKll<string, 1000>>(argv[1]);
-  Quality<random_device, SampledKll<string, 1000>, Reservoir<string, 1000>>(argv[1]);
+  // FrontCodedKll gets the bytes that SampledKll<string, 1000> spends on its strings.
+  // LazyKll<string, 600> shows lazy compaction matching Kll<string, 1000> with less room.
+  Quality<SampledKll<string, 1000>, RunLengthKll<string, 1000>,
+      FrontCodedKll<1000 * sizeof(string)>, Reservoir<string, 1000>, Kll<string, 1000>,
+      LazyKll<string, 1000>, LazyKll<string, 600>>(argv[1],
+      {"SampledKll", "RunLengthKll", "FrontCodedKll", "Reservoir", "Kll", "LazyKll",
+          "LazyKll<600>"}, options);
   // InteractiveTest<UrandomBool, Reservoir<string, 1000>>(argv[1]);
   //PrintTimer([&] { Benchmark<UrandomBool, Reservoir<string, 20000>>(argv[1]); return 0; });
   //PrintTimer([&] { Benchmark<UrandomBool, Kll<string, 1000>>(argv[1]); return 0; });
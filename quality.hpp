@@ -0,0 +1,300 @@
+#pragma once
+
+/// A parallel, bounded harness that measures the accuracy of sketches.
+///
+/// Quality<Sketches...>(filename, names, options) runs trials that build every sketch
+/// from the keys in a file and ask each for many percentiles. Each answer is scored
+/// against the exact range of percentiles that the returned key covers, so the error is
+/// zero if the key is a right answer and otherwise its distance, in percentiles, from
+/// the nearest right one.
+///
+/// Trials run in batches, spread over threads. Trial t draws from an mt19937_64 seeded
+/// with (options.seed, t), and all sketches in a trial see the same stream, so results
+/// do not depend on the number of threads or on their scheduling. After each batch the
+/// harness prints each sketch's mean error with a 95% confidence interval over trials.
+/// It stops after max_trials trials, or sooner once every interval is narrower than
+/// target_ci95. At the end it prints each sketch's mean ingest and query counters, and
+/// optionally writes every error to a CSV file and their summaries to a JSON file.
+/// Errors are kept only for the current batch: they stream to the CSV file and fold into
+/// running summaries, so memory stays bounded however many trials run.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "perf-counters.hpp"
+#include "utility.hpp"
+
+struct QualityOptions {
+  // Stops after this many trials; 0 means no limit.
+  uint64_t max_trials = 1000;
+  // Stops once every sketch's mean error is known to within this many percentiles, with
+  // 95% confidence; 0 turns the rule off.
+  double target_ci95 = 0;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  // Trials between checks of the stopping rule; 0 means four per thread.
+  uint64_t batch = 0;
+  uint64_t seed = 0;
+  // Asked of every sketch in every trial; empty means 1 through 99.
+  std::vector<double> percentiles;
+  // Where to write the errors, if not empty.
+  std::string csv, json;
+};
+
+// Counters for the phases of Quality's trials, for one sketch. They only hold totals;
+// each worker counts with counters of its own and adds what each phase counted here.
+struct Phases {
+  PerfCounters ingest{false}, query{false};
+};
+
+template <typename T, typename Truth, typename... Sketches>
+class QualityHarness {
+  static constexpr size_t N = sizeof...(Sketches);
+
+  const std::vector<T>& keys_;
+  const Truth& index_;
+  const std::vector<std::string>& names_;
+  QualityOptions options_;
+  // errors_[s][(t - first_) * percentiles + i] is sketch s's error at percentile i in
+  // trial t of the current batch.
+  std::array<std::vector<double>, N> errors_;
+  // Each sketch's mean error over percentiles in every trial so far, and its error at
+  // each percentile.
+  std::array<RunningSummary, N> trial_means_;
+  std::array<std::vector<RunningSummary>, N> at_percentile_;
+  std::array<Phases, N> phases_;
+  std::ofstream csv_;
+
+  // Workers run trials [first_, end_) of batch number batches_, claiming them through
+  // next_, and count themselves in finished_ when there are none left.
+  std::mutex lock_;
+  std::condition_variable changed_;
+  uint64_t first_ = 0, end_ = 0, batches_ = 0, finished_ = 0;
+  bool stop_ = false;
+  std::atomic<uint64_t> next_{0};
+
+  size_t Percentiles() const { return options_.percentiles.size(); }
+
+  // Builds one sketch and stores its error at each percentile in errors, counting each
+  // phase with counters and adding the counts to phases.
+  template <typename Sketch>
+  void Measure(uint64_t trial, PerfCounters* counters, Phases* phases,
+      double* errors) const {
+    std::seed_seq seeds = {static_cast<uint32_t>(options_.seed),
+        static_cast<uint32_t>(options_.seed >> 32), static_cast<uint32_t>(trial),
+        static_cast<uint32_t>(trial >> 32)};
+    std::mt19937_64 r(seeds);
+    Sketch sketch;
+    counters->Clear();
+    counters->Start();
+    for (const auto& key : keys_) sketch.Insert(&r, key, 0);
+    counters->Stop();
+    phases->ingest.Add(*counters);
+    std::vector<T> answers;
+    answers.reserve(Percentiles());
+    counters->Clear();
+    counters->Start();
+    const auto cdf = sketch.GetCdf();
+    for (const double p : options_.percentiles) answers.push_back(cdf.GetValue(p));
+    counters->Stop();
+    phases->query.Add(*counters);
+    for (size_t i = 0; i < Percentiles(); ++i) {
+      errors[i] = 100 * Error(index_.Range(answers[i]), options_.percentiles[i] / 100);
+    }
+  }
+
+  template <size_t... I>
+  void Trial(uint64_t trial, PerfCounters* counters, std::array<Phases, N>* phases,
+      std::index_sequence<I...>) {
+    const size_t offset = (trial - first_) * Percentiles();
+    const int unused[] = {(Measure<Sketches>(trial, counters, &(*phases)[I],
+        &errors_[I][offset]), 0)...};
+    (void)unused;
+  }
+
+  // Counters for the calling thread. A process out of file descriptors gets counters
+  // that open nothing, after one warning, so the trials still run and only the report
+  // leaves out the threads that could not count.
+  static std::unique_ptr<PerfCounters> OpenCounters() {
+    try {
+      return std::make_unique<PerfCounters>();
+    } catch (const std::runtime_error& e) {
+      static std::atomic<bool> warned(false);
+      if (!warned.exchange(true)) {
+        std::cerr << e.what() << "; counters leave out some threads" << std::endl;
+      }
+      return std::make_unique<PerfCounters>(false);
+    }
+  }
+
+  // Runs every batch until Run() stops the workers. Counters only count the thread that
+  // opened them, so each worker opens one set, reuses it for every phase of every
+  // trial, and adds up its totals when it is done.
+  void Work() {
+    const auto counters = OpenCounters();
+    std::array<Phases, N> phases;
+    for (uint64_t done = 0;; ++done) {
+      {
+        std::unique_lock<std::mutex> guard(lock_);
+        changed_.wait(guard, [&] { return stop_ || batches_ > done; });
+        if (stop_) break;
+      }
+      for (uint64_t trial; (trial = next_++) < end_;) {
+        Trial(trial, counters.get(), &phases, std::make_index_sequence<N>());
+      }
+      std::lock_guard<std::mutex> guard(lock_);
+      ++finished_;
+      changed_.notify_all();
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    for (size_t s = 0; s < N; ++s) {
+      phases_[s].ingest.Add(phases[s].ingest);
+      phases_[s].query.Add(phases[s].query);
+    }
+  }
+
+  // Runs trials [first, end) on workers, and waits for them.
+  void RunBatch(uint64_t first, uint64_t end, uint64_t workers) {
+    for (auto& errors : errors_) errors.resize((end - first) * Percentiles());
+    std::unique_lock<std::mutex> guard(lock_);
+    first_ = first;
+    end_ = end;
+    next_ = first;
+    finished_ = 0;
+    ++batches_;
+    changed_.notify_all();
+    changed_.wait(guard, [&] { return finished_ == workers; });
+  }
+
+  // Adds the errors of trials [first, end) to the summaries, in order of trials so that
+  // they do not depend on the workers, and to the CSV file.
+  void Record(uint64_t first, uint64_t end) {
+    for (size_t s = 0; s < N; ++s) {
+      for (uint64_t t = first; t < end; ++t) {
+        const auto begin = errors_[s].begin() + (t - first) * Percentiles();
+        trial_means_[s].Add(
+            std::accumulate(begin, begin + Percentiles(), 0.0) / Percentiles());
+        for (size_t i = 0; i < Percentiles(); ++i) {
+          at_percentile_[s][i].Add(begin[i]);
+          if (csv_.is_open()) {
+            csv_ << names_[s] << ',' << t << ',' << options_.percentiles[i] << ','
+                 << begin[i] << '\n';
+          }
+        }
+      }
+    }
+  }
+
+  void WriteJson(uint64_t trials) const {
+    std::ofstream out(options_.json);
+    out << "{\n  \"keys\": " << keys_.size() << ",\n  \"seed\": " << options_.seed
+        << ",\n  \"trials\": " << trials << ",\n  \"sketches\": [";
+    for (size_t s = 0; s < N; ++s) {
+      out << (s ? "," : "") << "\n    {\"name\": " << JsonString(names_[s])
+          << ",\n     \"trial_mean_error\": " << JsonSummary(trial_means_[s].Get())
+          << ",\n     \"percentiles\": [";
+      for (size_t i = 0; i < Percentiles(); ++i) {
+        out << (i ? "," : "") << "\n       {\"percentile\": " << options_.percentiles[i]
+            << ", \"error\": " << JsonSummary(at_percentile_[s][i].Get()) << "}";
+      }
+      out << "]}";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+ public:
+  QualityHarness(const std::vector<T>& keys, const Truth& index,
+      const std::vector<std::string>& names, const QualityOptions& options)
+      : keys_(keys), index_(index), names_(names), options_(options) {
+    assert(names.size() == N);
+    if (options_.percentiles.empty()) {
+      for (int p = 1; p < 100; ++p) options_.percentiles.push_back(p);
+    }
+    if (options_.batch == 0) options_.batch = 4 * options_.threads;
+    for (auto& summaries : at_percentile_) summaries.resize(Percentiles());
+    if (!options_.csv.empty()) {
+      csv_.open(options_.csv);
+      if (!csv_) throw std::runtime_error("cannot write " + options_.csv);
+      csv_ << "sketch,trial,percentile,error\n";
+    }
+  }
+
+  void Run() {
+    std::cout << std::setw(8) << "trials";
+    for (const auto& name : names_) std::cout << std::setw(24) << name;
+    std::cout << std::endl;
+    uint64_t workers = std::min<uint64_t>(options_.threads, options_.batch);
+    if (options_.max_trials > 0) workers = std::min(workers, options_.max_trials);
+    std::vector<std::thread> threads;
+    for (uint64_t i = 0; i < workers; ++i) threads.emplace_back([this] { Work(); });
+    uint64_t trials = 0;
+    while (true) {
+      uint64_t end = trials + options_.batch;
+      if (options_.max_trials > 0) end = std::min(end, options_.max_trials);
+      RunBatch(trials, end, workers);
+      Record(trials, end);
+      trials = end;
+
+      bool precise = options_.target_ci95 > 0 && trials >= 2;
+      std::cout << std::setw(8) << trials << std::fixed << std::setprecision(4);
+      for (size_t s = 0; s < N; ++s) {
+        const Summary summary = trial_means_[s].Get();
+        precise = precise && summary.ci95 <= options_.target_ci95;
+        std::cout << std::setw(12) << summary.mean << " +/- " << std::setw(7)
+                  << summary.ci95;
+      }
+      std::cout << std::endl;
+      if (precise || trials == options_.max_trials) break;
+    }
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      stop_ = true;
+      changed_.notify_all();
+    }
+    for (auto& thread : threads) thread.join();
+    for (size_t s = 0; s < N; ++s) {
+      std::cout << names_[s] << std::endl
+                << "  ingest: " << phases_[s].ingest.Report(trials) << std::endl
+                << "  query:  " << phases_[s].query.Report(trials) << std::endl;
+    }
+    if (!options_.json.empty()) WriteJson(trials);
+  }
+};
+
+template <typename... Sketches, typename T, typename Truth>
+void Quality(const std::vector<T>& keys, const Truth& index,
+    const std::vector<std::string>& names, const QualityOptions& options) {
+  QualityHarness<T, Truth, Sketches...>(keys, index, names, options).Run();
+}
+
+template <typename... Sketches>
+void Quality(const std::string& filename, const std::vector<std::string>& names,
+    const QualityOptions& options) {
+  std::vector<std::string> keys;
+  {
+    std::string word;
+    std::ifstream file(filename);
+    while (file >> word) keys.push_back(word);
+  }
+  const auto index = [&] {
+    ScopedProfiler profile("ground truth");
+    return GroundTruth(keys);
+  }();
+  Quality<Sketches...>(keys, index, names, options);
+}
@@ -0,0 +1,101 @@
+#include "check.hpp"
+#include "rank-oracle.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Skewed keys, so that many repeat, from a domain with gaps, so that some do not occur.
+vector<string> Keys(mt19937_64* r, size_t count) {
+  vector<string> keys;
+  for (size_t i = 0; i < count; ++i) {
+    const uint64_t x = (*r)() % 1000;
+    keys.push_back("key-" + to_string(2 * (x * x % 20000)));
+  }
+  return keys;
+}
+
+// Ranks must match counts in a std::map, for keys in the stream and keys between them.
+void CheckRanks(const RankOracle<string>& oracle, const vector<string>& keys) {
+  map<string, uint64_t> exact;
+  for (const auto& key : keys) ++exact[key];
+  Check(oracle.Total() == keys.size(), "total");
+  Check(oracle.Unique() == exact.size(), "unique");
+  uint64_t below = 0;
+  for (const auto& p : exact) {
+    Check(oracle.Ranks(p.first) == make_pair(below, below + p.second), "ranks");
+    const auto absent = oracle.Ranks(p.first + "!");
+    Check(absent == make_pair(below + p.second, below + p.second), "absent ranks");
+    below += p.second;
+  }
+  Check(oracle.Ranks("") == make_pair(uint64_t{0}, uint64_t{0}), "before all");
+  Check(oracle.Range("~").first == 1.0, "after all");
+}
+
+int main() {
+  mt19937_64 r(7);
+  for (const unsigned threads : {1, 3, 8}) {
+    vector<uint64_t> v(100000);
+    for (auto& x : v) x = r() % 5000;
+    ParallelSort(&v, threads);
+    Check(is_sorted(v.begin(), v.end()), "parallel sort");
+  }
+  const vector<string> keys = Keys(&r, 200000);
+  for (const unsigned threads : {1, 5}) {
+    CheckRanks(RankOracle<string>::FromKeys(keys, threads), keys);
+  }
+  // A small memory budget makes FromFile spill over a hundred runs, more than it merges
+  // at once, and merge them in passes.
+  char name[] = "/tmp/rank-oracle-test-XXXXXX";
+  const int fd = mkstemp(name);
+  Check(fd >= 0, "temporary file");
+  close(fd);
+  {
+    ofstream file(name);
+    for (const auto& key : keys) file << key << '\n';
+  }
+  char directory[] = "/tmp/rank-oracle-test-runs-XXXXXX";
+  Check(mkdtemp(directory) != nullptr, "temporary directory");
+  CheckRanks(RankOracle<string>::FromFile(name, 40000, 2, directory), keys);
+  // Every run is removed once merged.
+  Check(rmdir(directory) == 0, "runs removed");
+  CheckRanks(RankOracle<string>::FromFile(name), keys);
+
+  // Spilled doubles must read back exactly, however many digits they need.
+  vector<double> doubles(10000);
+  for (auto& x : doubles) x = uniform_real_distribution<double>(0, 1)(r);
+  {
+    ofstream file(name);
+    file << setprecision(numeric_limits<double>::max_digits10);
+    for (const double x : doubles) file << x << '\n';
+  }
+  const auto spilled = RankOracle<double>::FromFile(name, 4096, 2);
+  sort(doubles.begin(), doubles.end());
+  Check(spilled.Total() == doubles.size(), "double total");
+  Check(spilled.Unique() == doubles.size(), "double unique");
+  for (size_t i = 0; i < doubles.size(); i += 97) {
+    Check(spilled.Ranks(doubles[i]) == make_pair(uint64_t{i}, uint64_t{i + 1}),
+        "double ranks");
+  }
+  remove(name);
+
+  bool threw = false;
+  try {
+    RankOracle<string>::FromFile(name);
+  } catch (const runtime_error&) {
+    threw = true;
+  }
+  Check(threw, "a missing file is an error");
+  cout << "OK" << endl;
+}
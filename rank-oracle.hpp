@@ -0,0 +1,272 @@
+#pragma once
+
+/// Exact ranks of the keys of a stream, for scoring sketches.
+///
+/// RankOracle<T> holds the distinct keys of a stream in sorted order and, beside each
+/// one, the number of keys in the stream up to and including it. Range(key) then finds
+/// the range of quantiles that a key covers with one binary search, and costs a key and
+/// a uint64_t per distinct key, rather than a hash map node per key.
+///
+/// Both FromKeys() and FromFile() first count equal keys in a hash map, and then sort
+/// only the distinct keys, on several threads. FromFile() reads keys with >> and needs
+/// memory only for the distinct keys: whenever the counts of the keys read so far take
+/// more than a given number of bytes, it sorts them, writes them to a temporary file,
+/// and starts over. At the end it merges those files, at most MERGE_FAN_IN of them at a
+/// time so that it never holds more files open, and removes them, also when an
+/// exception cuts it short. A file that cannot be read is an error, not an empty stream.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "memory.hpp"
+
+// Sorts v with std::sort on equal slices in parallel, then merges neighbouring slices
+// in rounds, each of which merges in parallel too.
+template <typename T>
+void ParallelSort(std::vector<T>* v, unsigned threads) {
+  // Below a few thousand keys per thread, threads cost more than they save.
+  threads = std::max<size_t>(1, std::min<size_t>(threads, v->size() / 4096));
+  std::vector<size_t> bounds;
+  for (unsigned i = 0; i <= threads; ++i) bounds.push_back(v->size() * i / threads);
+  const auto at = [v, &bounds](size_t i) { return v->begin() + bounds[i]; };
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; ++i) {
+    workers.emplace_back([&at, i] { std::sort(at(i), at(i + 1)); });
+  }
+  for (auto& worker : workers) worker.join();
+  for (unsigned width = 1; width < threads; width *= 2) {
+    workers.clear();
+    for (unsigned i = 0; i + width < threads; i += 2 * width) {
+      const unsigned end = std::min(i + 2 * width, threads);
+      workers.emplace_back(
+          [&at, i, width, end] { std::inplace_merge(at(i), at(i + width), at(end)); });
+    }
+    for (auto& worker : workers) worker.join();
+  }
+}
+
+template <typename T>
+class RankOracle {
+  using Counts = std::unordered_map<T, uint64_t>;
+  // The bytes a new key adds to Counts, besides HeapBytes(key): the key, its count, the
+  // node's link and cached hash, and a bucket.
+  static constexpr size_t NODE_BYTES = sizeof(T) + 4 * sizeof(void*);
+  // The most runs that FromFile() merges, and so holds open, at once.
+  static constexpr size_t MERGE_FAN_IN = 64;
+
+  std::vector<T> keys_;
+  // cumulative_[i] is the number of keys in the stream that are at most keys_[i].
+  std::vector<uint64_t> cumulative_;
+
+  static unsigned DefaultThreads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  static std::string TemporaryDirectory() {
+    const char* directory = std::getenv("TMPDIR");
+    return directory ? directory : "/tmp";
+  }
+
+  // Keys must arrive in order.
+  void Append(T&& key, uint64_t count) {
+    if (!keys_.empty() && keys_.back() == key) {
+      cumulative_.back() += count;
+    } else {
+      keys_.push_back(std::move(key));
+      cumulative_.push_back(Total() + count);
+    }
+  }
+
+  // Empties counts into a vector sorted by key.
+  static std::vector<std::pair<T, uint64_t>> Sorted(Counts* counts, unsigned threads) {
+    std::vector<std::pair<T, uint64_t>> result;
+    result.reserve(counts->size());
+    for (auto& count : *counts) result.emplace_back(std::move(count.first), count.second);
+    counts->clear();
+    ParallelSort(&result, threads);
+    return result;
+  }
+
+  // The temporary files of FromFile(), each a run of (key, count) pairs in order of
+  // keys. They are removed when Runs goes out of scope, however that happens.
+  class Runs {
+    std::string directory_;
+    std::vector<std::string> names_;
+
+   public:
+    explicit Runs(std::string directory) : directory_(std::move(directory)) {}
+    Runs(const Runs&) = delete;
+    Runs& operator=(const Runs&) = delete;
+    ~Runs() { RemoveFirst(names_.size()); }
+
+    const std::vector<std::string>& Names() const { return names_; }
+
+    // Creates an empty run and returns its name.
+    std::string Create() {
+      std::string name = directory_ + "/rank-oracle-XXXXXX";
+      const int fd = mkstemp(&name[0]);
+      if (fd < 0) throw std::runtime_error("cannot create a file in " + directory_);
+      close(fd);
+      names_.push_back(name);
+      return name;
+    }
+
+    void RemoveFirst(size_t count) {
+      for (size_t i = 0; i < count; ++i) std::remove(names_[i].c_str());
+      names_.erase(names_.begin(), names_.begin() + count);
+    }
+  };
+
+  // Writes (key, count) pairs to a run, with enough digits that floating-point keys
+  // read back exactly.
+  class RunWriter {
+    std::string name_;
+    std::ofstream out_;
+
+   public:
+    explicit RunWriter(std::string name) : name_(std::move(name)), out_(name_) {
+      out_ << std::setprecision(std::numeric_limits<T>::max_digits10);
+    }
+
+    void operator()(const T& key, uint64_t count) {
+      out_ << key << ' ' << count << '\n';
+    }
+
+    void Close() {
+      out_.close();
+      if (!out_) throw std::runtime_error("cannot write " + name_);
+    }
+  };
+
+  // Empties counts into a new run, in order of keys.
+  static void Spill(Counts* counts, unsigned threads, Runs* runs) {
+    RunWriter run(runs->Create());
+    for (const auto& count : Sorted(counts, threads)) run(count.first, count.second);
+    run.Close();
+  }
+
+  static RankOracle FromCounts(Counts* counts, unsigned threads) {
+    RankOracle result;
+    for (auto& count : Sorted(counts, threads)) {
+      result.Append(std::move(count.first), count.second);
+    }
+    return result;
+  }
+
+  // Merges the runs named names[0, count) and passes each distinct key, in order, to
+  // emit with its total count.
+  template <typename Emit>
+  static void MergeRuns(const std::vector<std::string>& names, size_t count,
+      Emit&& emit) {
+    std::vector<std::ifstream> runs;
+    // The next key of each run, with its count and run.
+    using Head = std::tuple<T, uint64_t, size_t>;
+    const auto later = [](const Head& x, const Head& y) {
+      return std::get<0>(y) < std::get<0>(x);
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+    const auto advance = [&](size_t i) {
+      Head head;
+      std::get<2>(head) = i;
+      if (runs[i] >> std::get<0>(head) >> std::get<1>(head)) heads.push(std::move(head));
+    };
+    for (size_t i = 0; i < count; ++i) {
+      runs.emplace_back(names[i]);
+      if (!runs.back()) throw std::runtime_error("cannot read " + names[i]);
+      advance(i);
+    }
+    while (!heads.empty()) {
+      Head head = heads.top();
+      heads.pop();
+      advance(std::get<2>(head));
+      while (!heads.empty() && !(std::get<0>(head) < std::get<0>(heads.top()))) {
+        std::get<1>(head) += std::get<1>(heads.top());
+        const size_t run = std::get<2>(heads.top());
+        heads.pop();
+        advance(run);
+      }
+      emit(std::move(std::get<0>(head)), std::get<1>(head));
+    }
+    for (size_t i = 0; i < count; ++i) {
+      if (!runs[i].eof()) throw std::runtime_error("cannot read " + names[i]);
+    }
+  }
+
+ public:
+  static RankOracle FromKeys(const std::vector<T>& keys,
+      unsigned threads = DefaultThreads()) {
+    Counts counts;
+    for (const auto& key : keys) ++counts[key];
+    return FromCounts(&counts, threads);
+  }
+
+  // Keeps counts of at most about memory bytes at a time, besides the distinct keys.
+  static RankOracle FromFile(const std::string& filename, size_t memory = size_t(1) << 30,
+      unsigned threads = DefaultThreads(),
+      const std::string& directory = TemporaryDirectory()) {
+    std::ifstream in(filename);
+    if (!in) throw std::runtime_error("cannot read " + filename);
+    Counts counts;
+    Runs runs(directory);
+    size_t bytes = 0;
+    T key;
+    while (in >> key) {
+      const size_t key_bytes = NODE_BYTES + HeapBytes(key);
+      if (++counts[std::move(key)] > 1) continue;
+      bytes += key_bytes;
+      if (bytes < memory) continue;
+      Spill(&counts, threads, &runs);
+      bytes = 0;
+    }
+    if (runs.Names().empty()) return FromCounts(&counts, threads);
+    if (!counts.empty()) Spill(&counts, threads, &runs);
+    while (runs.Names().size() > MERGE_FAN_IN) {
+      RunWriter merged(runs.Create());
+      MergeRuns(runs.Names(), MERGE_FAN_IN, merged);
+      merged.Close();
+      runs.RemoveFirst(MERGE_FAN_IN);
+    }
+    RankOracle result;
+    MergeRuns(runs.Names(), runs.Names().size(),
+        [&result](T&& key, uint64_t count) { result.Append(std::move(key), count); });
+    return result;
+  }
+
+  uint64_t Total() const { return cumulative_.empty() ? 0 : cumulative_.back(); }
+  size_t Unique() const { return keys_.size(); }
+
+  size_t MemoryUsage() const {
+    return sizeof(*this) + HeapBytes(keys_) + HeapBytes(cumulative_);
+  }
+
+  // The number of keys in the stream less than key, and at most key.
+  std::pair<uint64_t, uint64_t> Ranks(const T& key) const {
+    const auto i = std::lower_bound(keys_.begin(), keys_.end(), key) - keys_.begin();
+    const uint64_t below = (i == 0) ? 0 : cumulative_[i - 1];
+    if (i == keys_.size() || keys_[i] != key) return {below, below};
+    return {below, cumulative_[i]};
+  }
+
+  // The range of quantiles, between 0 and 1, that copies of key cover. A key that is
+  // not in the stream covers the empty range at its place in the order.
+  std::pair<double, double> Range(const T& key) const {
+    const auto ranks = Ranks(key);
+    const double total = Total();
+    return {ranks.first / total, ranks.second / total};
+  }
+};
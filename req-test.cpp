@@ -0,0 +1,104 @@
+#include "check.hpp"
+#include "req.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t N = 1000000;
+
+// The error in the number of keys beyond cdf.GetValue(p), on the protected side,
+// relative to that number.
+template <typename Cdf>
+double TailError(const Cdf& cdf, const vector<uint32_t>& sorted, double p, bool high) {
+  const uint32_t value = cdf.GetValue(p);
+  const double beyond = high
+      ? sorted.end() - upper_bound(sorted.begin(), sorted.end(), value)
+      : lower_bound(sorted.begin(), sorted.end(), value) - sorted.begin();
+  const double expected = sorted.size() * (high ? 100 - p : p) / 100;
+  return fabs(beyond - expected) / expected;
+}
+
+template <typename Sketch>
+void CheckTails(const Sketch& sketch, const vector<uint32_t>& sorted, bool high,
+    const char* what) {
+  const auto cdf = sketch.GetCdf();
+  for (const double tail : {1.0, 0.1, 0.01}) {
+    const double p = high ? 100 - tail : tail;
+    const double error = TailError(cdf, sorted, p, high);
+    cout << what << " p" << p << " relative error " << error << endl;
+    Check(error < 0.05, what);
+  }
+}
+
+int main() {
+  mt19937_64 r(11);
+  vector<uint32_t> keys(N);
+  for (auto& key : keys) key = r();
+  vector<uint32_t> sorted = keys;
+  sort(sorted.begin(), sorted.end());
+
+  Req<uint32_t, 12> high;
+  Req<uint32_t, 12, LowRanks> low;
+  for (const auto key : keys) {
+    high.Insert(&r, key, 0);
+    low.Insert(&r, key, 0);
+  }
+  Check(high.size == N, "size");
+  CheckTails(high, sorted, true, "HighRanks");
+  CheckTails(low, sorted, false, "LowRanks");
+
+  // Quarters of the stream merged into one sketch.
+  Req<uint32_t, 12> merged;
+  for (size_t part = 0; part < 4; ++part) {
+    Req<uint32_t, 12> quarter;
+    for (size_t i = part * N / 4; i < (part + 1) * N / 4; ++i) {
+      quarter.Insert(&r, keys[i], 0);
+    }
+    merged.Merge(&r, quarter);
+  }
+  Check(merged.size == N, "merged size");
+  CheckTails(merged, sorted, true, "merged");
+
+  // Sixteen shards merged pairwise, as a federated query would, keep the tails and
+  // stay about as small as one sketch of the whole stream.
+  vector<Req<uint32_t, 12>> shards(16);
+  for (size_t i = 0; i < N; ++i) shards[i % shards.size()].Insert(&r, keys[i], 0);
+  for (size_t width = 1; width < shards.size(); width *= 2) {
+    for (size_t i = 0; i + width < shards.size(); i += 2 * width) {
+      shards[i].Merge(&r, shards[i + width]);
+    }
+  }
+  Check(shards[0].size == N, "tree size");
+  CheckTails(shards[0], sorted, true, "tree");
+  cout << "memory " << high.MemoryUsage() << " whole, " << shards[0].MemoryUsage()
+       << " merged" << endl;
+  Check(shards[0].MemoryUsage() < 2 * high.MemoryUsage(), "merged memory");
+
+  // A sketch merged with itself counts every key twice.
+  Req<uint32_t, 12> twice = high;
+  twice.Merge(&r, twice);
+  Check(twice.size == 2 * N && high.size == N, "self merge");
+  CheckTails(twice, sorted, true, "self merge");
+
+  // Weighted keys count at their weight, and exemplars stay with their keys.
+  Req<uint32_t, 12, HighRanks, uint64_t> weighted;
+  uint64_t total = 0;
+  for (uint32_t key = 0; key < 100000; ++key) {
+    const uint64_t weight = 1 + key % 37;
+    weighted.InsertWeighted(&r, key, weight, uint64_t{key} * 3);
+    total += weight;
+  }
+  Check(weighted.size == total, "weighted size");
+  const auto cdf = weighted.GetCdf();
+  Check(cdf.Total() == total, "weighted total");
+  for (const double p : {50.0, 99.0, 99.9, 99.99}) {
+    Check(cdf.GetExemplar(p) == uint64_t{cdf.GetValue(p)} * 3, "exemplar");
+  }
+  cout << "OK" << endl;
+}
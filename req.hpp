@@ -0,0 +1,244 @@
+#pragma once
+
+/// A quantile sketch with relative error, for tail quantiles such as p99.9, after the
+/// REQ sketch of Cormode, Karnin, Liberty, Thaler and Veselý.
+///
+/// Req<T, K> keeps levels of keys as Kll does, where each key of level h stands for 2^h
+/// keys of the stream, but compacts them differently. Each level is split into sections
+/// of about K keys, and a compaction sorts the level and halves only its lowest
+/// sections, never the highest half of the level. The highest keys of the stream thus
+/// stay at the lowest levels, and the error in the rank of a key grows with the number
+/// of keys above it rather than with the size of the stream: the error at p99.99 is a
+/// hundred times smaller than at p99.
+///
+/// A level's compactions follow a binary counter: a compaction halves one section, plus
+/// one more for each trailing one bit of the number of compactions before it, so low
+/// sections are halved often and high ones rarely. After 2^(sections - 1) compactions a
+/// level doubles its sections and shrinks them by a factor of sqrt(2), so the space for
+/// n keys grows as K log^1.5(n / K) rather than as 1 / ε^2.
+///
+/// Merge() works level by level, as the paper's merge does. Each level takes the other
+/// sketch's keys at that level, ORs in its compaction counter and keeps the finer of
+/// the two section schedules. The levels then compact once, from the bottom up, so a
+/// merged sketch carries on with both schedules rather than starting over.
+///
+/// HighRanks, the default Accuracy, protects the high end of the order, as for latency
+/// SLOs. LowRanks mirrors it to protect the low end.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "memory.hpp"
+#include "payload.hpp"
+#include "stats.hpp"
+#include "utility.hpp"
+#include "weighted-cdf.hpp"
+
+struct HighRanks {
+  static constexpr bool HIGH = true;
+};
+
+struct LowRanks {
+  static constexpr bool HIGH = false;
+};
+
+template <typename T, uint32_t K, typename Accuracy = HighRanks,
+    typename Payload = NoPayload, typename Stats = NoStats>
+struct Req : private Stats {
+  static_assert(K >= 4 && K % 2 == 0, "sections must be even and hold at least 4 keys");
+
+ private:
+  struct Level {
+    std::vector<T> keys;
+    PayloadVector<Payload> payloads;
+    // keys[0, sorted) are in order: what the last compaction kept.
+    size_t sorted = 0;
+    // The number of compactions so far.
+    uint64_t state = 0;
+    uint32_t sections = 3;
+    double section_size = K;
+    // The nearest even number to section_size.
+    uint32_t rounded_size = K;
+    // The size at which the level compacts.
+    size_t capacity = 6 * K;
+
+    void Grow() {
+      section_size /= std::sqrt(2.0);
+      rounded_size = 2 * static_cast<uint32_t>(std::lround(section_size / 2));
+      sections *= 2;
+      capacity = 2 * sections * rounded_size;
+    }
+
+    // Appends that's keys, takes the compactions of both as the bits of state, and
+    // takes that's sections if they are finer. The caller compacts.
+    void Merge(const Level& that) {
+      const size_t size = keys.size();
+      keys.insert(keys.end(), that.keys.begin(), that.keys.end());
+      payloads.resize(keys.size());
+      CopyPayloads(that.payloads, 0, that.keys.size(), &payloads, size);
+      state |= that.state;
+      if (that.sections > sections) {
+        sections = that.sections;
+        section_size = that.section_size;
+        rounded_size = that.rounded_size;
+        capacity = that.capacity;
+      }
+    }
+  };
+
+  std::vector<Level> levels_;
+  uint64_t size_;
+  // Stats is a private base; see stats.hpp.
+  Stats& stats() { return *this; }
+  const Stats& stats() const { return *this; }
+
+  static uint32_t TrailingOnes(uint64_t x) {
+    uint32_t result = 0;
+    for (; x & 1; x >>= 1) ++result;
+    return result;
+  }
+
+  template <typename Random>
+  void Place(Random* rgen, const T& key, uint16_t level, const Payload& payload) {
+    if (level >= levels_.size()) levels_.resize(level + 1);
+    levels_[level].keys.push_back(key);
+    levels_[level].payloads.push_back(payload);
+    if (levels_[level].keys.size() >= levels_[level].capacity) Compact(rgen, level);
+  }
+
+  // Promotes every other key, from a random start, of the lowest keys of level (or the
+  // highest, for LowRanks) to the level above at twice the weight, and drops the rest.
+  template <typename Random>
+  void Compact(Random* rgen, uint16_t h) {
+    if (levels_[h].state >= (uint64_t{1} << (levels_[h].sections - 1))
+        && levels_[h].section_size / std::sqrt(2.0) >= 4) {
+      levels_[h].Grow();
+    }
+    const size_t size = levels_[h].keys.size();
+    // Growing the sections may leave room.
+    if (size < levels_[h].capacity) return;
+    stats().OnCompaction(h, size);
+    Sort(&levels_[h]);
+    const uint32_t sections =
+        std::min(TrailingOnes(levels_[h].state) + 1, levels_[h].sections);
+    ++levels_[h].state;
+    size_t keep = levels_[h].capacity / 2
+        + (levels_[h].sections - sections) * levels_[h].rounded_size;
+    if ((size - keep) % 2 == 1) ++keep;
+    const size_t low = Accuracy::HIGH ? 0 : keep;
+    const size_t high = Accuracy::HIGH ? size - keep : size;
+    stats().OnRandomDraw();
+    stats().OnBytesMoved((high - low) / 2 * sizeof(T));
+    std::uniform_int_distribution<uint32_t> dist(0, 1);
+    for (size_t i = low + dist(*rgen); i < high; i += 2) {
+      Place(rgen, levels_[h].keys[i], h + 1, levels_[h].payloads[i]);
+    }
+    auto& keys = levels_[h].keys;
+    if (Accuracy::HIGH) {
+      std::move(keys.begin() + high, keys.end(), keys.begin());
+      CopyPayloads(levels_[h].payloads, high, keep, &levels_[h].payloads, 0);
+    }
+    keys.resize(keep);
+    levels_[h].payloads.resize(keep);
+    levels_[h].sorted = keep;
+  }
+
+  // Without payloads, sorts only the keys that arrived since the last compaction and
+  // merges them with the rest.
+  void Sort(Level* level) {
+    const bool merge = std::is_same<Payload, NoPayload>::value
+        && stats().Comparisons() == nullptr;
+    const size_t begin = merge ? level->sorted : 0;
+    SortWithPayloads(level->keys.data() + begin, level->keys.size() - begin,
+        &level->payloads, begin, stats().Comparisons());
+    std::inplace_merge(level->keys.begin(), level->keys.begin() + begin,
+        level->keys.end());
+  }
+
+ public:
+  Req() : levels_(1), size_(0) {}
+
+  // Copies must rebind size to their own size_, as Kll's do.
+  Req(const Req& that) : Stats(that), levels_(that.levels_), size_(that.size_) {}
+
+  Req& operator=(const Req& that) {
+    stats() = that.stats();
+    levels_ = that.levels_;
+    size_ = that.size_;
+    return *this;
+  }
+
+  // The number of keys inserted, each counted at its weight.
+  const uint64_t& size = size_;
+
+  SketchStats GetStats() const { return stats().Snapshot(); }
+
+  size_t MemoryUsage() const {
+    size_t result = sizeof(*this) + levels_.capacity() * sizeof(Level);
+    for (const auto& level : levels_) {
+      result += HeapBytes(level.keys) + HeapBytes(level.payloads);
+    }
+    return result;
+  }
+
+  // Inserts key with weight 2^level.
+  template <typename Random>
+  void Insert(
+      Random* rgen, const T& key, uint16_t level, const Payload& payload = Payload()) {
+    size_ += uint64_t{1} << level;
+    Place(rgen, key, level, payload);
+  }
+
+  // Inserts key with an arbitrary weight by inserting it once at each level whose weight
+  // is a binary digit of weight.
+  template <typename Random>
+  void InsertWeighted(
+      Random* rgen, const T& key, uint64_t weight, const Payload& payload = Payload()) {
+    for (uint16_t level = 0; level < 64 && (weight >> level) > 0; ++level) {
+      if ((weight >> level) & 1) Insert(rgen, key, level, payload);
+    }
+  }
+
+  Cdf<T, Payload> GetCdf() const {
+    std::vector<std::pair<T, int64_t>> raw;
+    PayloadVector<Payload> payloads;
+    for (uint16_t h = 0; h < levels_.size(); ++h) {
+      for (size_t i = 0; i < levels_[h].keys.size(); ++i) {
+        raw.push_back({levels_[h].keys[i], int64_t{1} << h});
+        payloads.push_back(levels_[h].payloads[i]);
+      }
+    }
+    SortWithPayloads(raw.data(), raw.size(), &payloads, 0);
+    return Cdf<T, Payload>(raw, payloads);
+  }
+
+  // Weighs keys by level, as Kll's does.
+  WeightedCdf<T> GetWeightedCdf() const {
+    std::vector<std::pair<T, uint64_t>> raw;
+    for (uint16_t h = 0; h < levels_.size(); ++h) {
+      for (const T& key : levels_[h].keys) raw.push_back({key, uint64_t{1} << h});
+    }
+    return WeightedCdf<T>::FromUnsorted(std::move(raw));
+  }
+
+  template <typename Random>
+  void Merge(Random* rgen, const Req& that) {
+    if (&that == this) {
+      const Req copy(that);
+      Merge(rgen, copy);
+      return;
+    }
+    if (levels_.size() < that.levels_.size()) levels_.resize(that.levels_.size());
+    for (uint16_t h = 0; h < that.levels_.size(); ++h) levels_[h].Merge(that.levels_[h]);
+    size_ += that.size_;
+    // Compacting a level may add one above it.
+    for (uint16_t h = 0; h < levels_.size(); ++h) {
+      if (levels_[h].keys.size() >= levels_[h].capacity) Compact(rgen, h);
+    }
+  }
+};
@@ -7,6 +7,8 @@
 #include <utility>
 #include <vector>
 
+#include "memory.hpp"
+#include "numeric-sort.hpp"
 #include "utility.hpp"
 
 template <typename T, int32_t CAPACITY>
@@ -20,6 +22,8 @@ struct Reservoir {
 
   const uint64_t& size = size_;
 
+  size_t MemoryUsage() const { return sizeof(*this) + HeapBytes(data_); }
+
   template <typename Random>
   void Insert(Random* rgen, const T& key, uint8_t) {
     if (size_ < CAPACITY) {
@@ -45,13 +49,14 @@ struct Reservoir {
 
   Cdf<T> GetCdf() const {
     const uint64_t length = std::min(static_cast<uint64_t>(CAPACITY), size_);
+    std::vector<T> keys(data_.begin(), data_.begin() + length);
+    numeric_sort::Sort(keys.data(), keys.data() + length);
     std::vector<std::pair<T, int>> weights_(length);
     for ( int i = 0; i < length; ++i) {
-      weights_[i] = {data_[i], 1};
+      weights_[i] = {keys[i], 1};
     }
     //std::transform(&data_[0], &data_[size_], weights_.begin(),
     //    [](const T& key) { return std::make_pair(key, 1); });
-    std::sort(weights_.begin(), weights_.end());
     return Cdf<T>(weights_);
   }
 
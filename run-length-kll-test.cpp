@@ -0,0 +1,71 @@
+#include "check.hpp"
+#include "kll.hpp"
+#include "rank-oracle.hpp"
+#include "run-length-kll.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Draws from values 0..width - 1 with a Zipf law of exponent 1.1, so a few dominate.
+vector<uint32_t> Zipf(mt19937_64* r, size_t count, size_t width) {
+  vector<double> cdf(width);
+  double total = 0;
+  for (size_t i = 0; i < width; ++i) cdf[i] = total += pow(i + 1.0, -1.1);
+  uniform_real_distribution<double> u(0, total);
+  vector<uint32_t> result(count);
+  for (auto& key : result) key = lower_bound(cdf.begin(), cdf.end(), u(*r)) - cdf.begin();
+  return result;
+}
+
+int main() {
+  mt19937_64 r(28);
+
+  // A few hot values are exact, where Kll of the same size is not.
+  const vector<uint32_t> zipf = Zipf(&r, 1000000, 20);
+  const auto zipf_oracle = RankOracle<uint32_t>::FromKeys(zipf);
+  RunLengthKll<uint32_t, 200> runs;
+  Kll<uint32_t, 200> kll;
+  for (const auto key : zipf) {
+    runs.Insert(&r, key, 0);
+    kll.Insert(&r, key, 0);
+  }
+  const double runs_error = MaxError(runs, zipf_oracle);
+  const double kll_error = MaxError(kll, zipf_oracle);
+  cout << "Zipf of 20 values: RunLengthKll " << runs_error << ", Kll " << kll_error
+       << " percentiles" << endl;
+  Check(runs_error == 0, "low-cardinality stream is exact");
+
+  // String keys survive compaction: every answer is a key of the stream.
+  vector<string> keys;
+  for (const auto key : Zipf(&r, 100000, 500)) keys.push_back("/path/" + to_string(key));
+  const auto string_oracle = RankOracle<string>::FromKeys(keys);
+  RunLengthKll<string, 100> strings;
+  for (const auto& key : keys) strings.Insert(&r, key, 0);
+  const auto cdf = strings.GetCdf();
+  for (int p = 1; p < 100; ++p) {
+    const auto ranks = string_oracle.Ranks(cdf.GetValue(p));
+    Check(ranks.second > ranks.first, "string answers are keys of the stream");
+  }
+  const double string_error = MaxError(strings, string_oracle);
+  cout << "Zipf of 500 strings: RunLengthKll " << string_error << " percentiles" << endl;
+  Check(string_error < 10, "string accuracy");
+
+  // Distinct keys fall back to Kll's accuracy.
+  vector<uint32_t> distinct(1000000);
+  for (auto& key : distinct) key = r();
+  const auto distinct_oracle = RankOracle<uint32_t>::FromKeys(distinct);
+  RunLengthKll<uint32_t, 1000> wide;
+  for (const auto key : distinct) wide.Insert(&r, key, 0);
+  const double wide_error = MaxError(wide, distinct_oracle);
+  cout << "distinct keys: RunLengthKll " << wide_error << " percentiles" << endl;
+  Check(wide_error < 3, "high-cardinality accuracy");
+  cout << "OK" << endl;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+/// A KLL sketch that stores runs of equal keys.
+///
+/// RunLengthKll<T, N> has the same levels and compaction schedule as Kll<T, N>, but each
+/// entry of a level is a (key, count) pair that stands for count copies of key at that
+/// level's weight, and N limits entries rather than copies. Compacting a level sorts it
+/// and merges equal neighbours. Only if that frees less than half of the level does it
+/// keep every other copy, counting copies through the runs in the same way Kll does, and
+/// pass the survivors to the next level.
+///
+/// On streams dominated by a few hot values, each entry holds many copies and levels
+/// often compact without discarding anything, so accuracy per byte rises and there are
+/// fewer entries to sort.
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "memory.hpp"
+#include "utility.hpp"
+
+template <typename T, uint32_t CAPACITY>
+struct RunLengthKll {
+ private:
+  using Run = std::pair<T, uint64_t>;
+
+  std::vector<std::vector<Run>> data_;
+  std::deque<uint32_t> size_limits_;
+  static uint32_t Round(uint32_t x) { return 2 * (x / 2); }
+
+  void AddLevel() {
+    data_.push_back(std::vector<Run>());
+    size_limits_.push_front(Round(size_limits_[0] * 2 / 3));
+  }
+
+  // Sorts a level and merges its runs of equal keys.
+  void Coalesce(uint16_t level) {
+    auto& runs = data_[level];
+    if (runs.size() < 2) return;
+    std::sort(runs.begin(), runs.end(),
+        [](const Run& x, const Run& y) { return x.first < y.first; });
+    auto last = runs.begin();
+    for (auto i = runs.begin() + 1; i != runs.end(); ++i) {
+      if (i->first == last->first) {
+        last->second += i->second;
+      } else if (++last != i) {
+        *last = std::move(*i);
+      }
+    }
+    runs.erase(last + 1, runs.end());
+  }
+
+  template <typename Random>
+  void Compact(Random* rgen, uint16_t level) {
+    Coalesce(level);
+    if (data_[level].size() <= size_limits_[level] / 2) return;
+    // Appending to the next level can compact it or add a level, so the runs are moved
+    // out of data_ first.
+    std::vector<Run> runs;
+    runs.swap(data_[level]);
+    std::uniform_int_distribution<uint32_t> dist(0, 1);
+    const uint64_t offset = dist(*rgen);
+    // Kll keeps the copies at even (or odd) positions of the sorted level; Kept(p) counts
+    // the kept positions less than p.
+    const auto kept = [offset](uint64_t p) { return (p + 1 - offset) / 2; };
+    uint64_t position = 0;
+    for (const auto& run : runs) {
+      const uint64_t count = kept(position + run.second) - kept(position);
+      position += run.second;
+      if (count > 0) Append(rgen, run.first, count, level + 1);
+    }
+  }
+
+  template <typename Random>
+  void Append(Random* rgen, const T& key, uint64_t count, uint16_t level) {
+    while (level >= data_.size()) AddLevel();
+    if (!data_[level].empty() && data_[level].back().first == key) {
+      data_[level].back().second += count;
+      return;
+    }
+    if (data_[level].size() >= size_limits_[level]) Compact(rgen, level);
+    data_[level].push_back({key, count});
+  }
+
+ public:
+  explicit RunLengthKll() : data_(1), size_limits_(1, Round(CAPACITY / 3)) {}
+
+  size_t MemoryUsage() const {
+    return sizeof(*this) + HeapBytes(data_) + HeapBytes(size_limits_);
+  }
+
+  template <typename Random>
+  void Insert(Random* rgen, const T& key, uint16_t level) {
+    Append(rgen, key, 1, level);
+  }
+
+  // A run can hold any count, so a pre-aggregated (key, weight) pair is a single entry.
+  template <typename Random>
+  void InsertWeighted(Random* rgen, const T& key, uint64_t weight) {
+    if (weight > 0) Append(rgen, key, weight, 0);
+  }
+
+  Cdf<T> GetCdf() const {
+    std::vector<std::pair<T, double>> raw;
+    double weight = 1;
+    for (const auto& runs : data_) {
+      for (const auto& run : runs) raw.push_back({run.first, weight * run.second});
+      weight *= 2;
+    }
+    std::sort(raw.begin(), raw.end());
+    return Cdf<T>(raw);
+  }
+
+  template <typename Random>
+  void Merge(Random* rgen, const RunLengthKll& that) {
+    for (uint16_t level = 0; level < that.data_.size(); ++level) {
+      for (const auto& run : that.data_[level]) {
+        Append(rgen, run.first, run.second, level);
+      }
+    }
+  }
+};
@@ -14,12 +14,17 @@
 /// MRL or GK sketch on top. Its space usage (N) is -\sqrt{ln δ}/ε to answer a single
 /// quantile or -\sqrt{ln δε}/ε to answer all quantile queries correctly.
 ///
-/// This sketch supports three operations: Insert(T), CDF(), and Merge(SampledKll).
+/// This sketch supports four operations: Insert(T), InsertWeighted(T, weight), CDF(),
+/// and Merge(SampledKll). Each key may carry a Payload, such as a trace ID, which the CDF
+/// reports as the exemplar of its key; see payload.hpp. A Stats policy can count the
+/// sketch's internal events; see stats.hpp. Watch() keeps chosen percentiles current as
+/// keys arrive; see watched-quantiles.hpp.
 
 #include <algorithm>
 #include <bitset>
 #include <cassert>
 #include <climits>
+#include <cmath>
 #include <cstdint>
 #include <iostream>
 #include <limits>
@@ -27,7 +32,13 @@
 #include <utility>
 #include <vector>
 
+#include "memory.hpp"
+#include "numeric-sort.hpp"
+#include "payload.hpp"
+#include "stats.hpp"
 #include "utility.hpp"
+#include "watched-quantiles.hpp"
+#include "weighted-cdf.hpp"
 
 // template <int32_t CAPACITY>
 // void PrintKllArray() {
@@ -36,8 +47,9 @@
 //   std::cout << "--\n";
 // }
 
-template <typename T, int32_t CAPACITY>
-struct SampledKll {
+template <typename T, int32_t CAPACITY, typename Payload = NoPayload,
+    typename Stats = NoStats>
+struct SampledKll : private Stats {
  private:
   class KllArrayDetails {
     template <typename Int>
@@ -85,25 +97,81 @@ struct SampledKll {
 
   static constexpr KllArrayType LEVEL_START = KllArrayDetails::KllArray();
   std::array<T, CAPACITY> data_{};
+  PayloadArray<Payload, CAPACITY> payloads_{};
   std::array<int32_t, LEVEL_START.size() - 1> level_sizes_{};
   int64_t sample_weight_ = 0;
   std::bitset<LEVEL_START.size() - 1> heavies_ = 0;
   int16_t sample_height_ = 1 - level_sizes_.size();
+  WatchedQuantiles<T> watch_{16 * CAPACITY};
+  // Stats is a private base; see stats.hpp.
+  Stats& stats() { return *this; }
+  const Stats& stats() const { return *this; }
+
+  bool Empty() const {
+    return sample_weight_ == 0
+        && std::all_of(level_sizes_.begin(), level_sizes_.end(),
+            [](int32_t size) { return size == 0; });
+  }
+
+  void UpdateWatch() {
+    if (!watch_.NeedsRefresh() || Empty()) return;
+    stats().OnWatchRefresh();
+    watch_.Refresh(GetCdf());
+  }
 
  public:
-  Cdf<T> GetCdf() const {
-    std::vector<std::pair<T, double>> raw;
-    if (sample_weight_) raw.push_back({data_[0], sample_weight_});
+  SketchStats GetStats() const { return stats().Snapshot(); }
+
+  // Counts every slot of data_, since slots past a level's size still hold old keys.
+  size_t MemoryUsage() const {
+    return sizeof(*this) + HeapBytes(data_) + HeapBytes(payloads_) + watch_.HeapBytes();
+  }
+
+  // Keeps the key at percentile current as keys arrive, to within tolerance
+  // percentiles. A tolerance of a small fraction of the sketch's error, such as 0.01,
+  // avoids most recomputation. Returns the index to pass to GetWatched().
+  size_t Watch(double percentile, double tolerance = 0) {
+    const size_t result = watch_.Watch(percentile, tolerance);
+    UpdateWatch();
+    return result;
+  }
+
+  // GetCdf().GetValue(percentile) for the i-th watched percentile, in O(1) time.
+  const T& GetWatched(size_t i) const { return watch_.Get(i); }
+
+  // Calls f(key, weight, payload) for every key the sketch holds, in no particular
+  // order.
+  template <typename Function>
+  void ForEachKey(Function f) const {
+    if (sample_weight_) f(data_[0], sample_weight_, payloads_[0]);
     int64_t weight = 1ll << std::max(0, +sample_height_);
     for (int16_t level = std::max(0, -sample_height_); level < level_sizes_.size();
          ++level) {
       for (int32_t i = 0; i < level_sizes_[level]; ++i) {
-        raw.push_back({data_[LEVEL_START[level] + i], weight});
+        f(data_[LEVEL_START[level] + i], weight, payloads_[LEVEL_START[level] + i]);
       }
       weight *= 2;
     }
-    std::sort(raw.begin(), raw.end());
-    return Cdf<T>(raw);
+  }
+
+  Cdf<T, Payload> GetCdf() const {
+    std::vector<std::pair<T, double>> raw;
+    PayloadVector<Payload> payloads;
+    ForEachKey([&](const T& key, int64_t weight, const Payload& payload) {
+      raw.push_back({key, weight});
+      payloads.push_back(payload);
+    });
+    SortWithPayloads(raw.data(), raw.size(), &payloads, 0);
+    return Cdf<T, Payload>(raw, payloads);
+  }
+
+  // The keys at the weights ForEachKey() gives them; see weighted-cdf.hpp.
+  WeightedCdf<T> GetWeightedCdf() const {
+    std::vector<std::pair<T, uint64_t>> raw;
+    ForEachKey([&](const T& key, int64_t weight, const Payload&) {
+      raw.push_back({key, static_cast<uint64_t>(weight)});
+    });
+    return WeightedCdf<T>::FromUnsorted(std::move(raw));
   }
 
  private:
@@ -111,10 +179,16 @@ struct SampledKll {
   void Compress(Random* rgen, int16_t level, int32_t len) {
     // std::cout << "Compress level: " << level << std::endl;
     T* const keys = &data_[LEVEL_START[level]];
-    std::sort(keys, keys + len);
+    stats().OnCompaction(level, len);
+    SortWithPayloads(keys, len, &payloads_, LEVEL_START[level], stats().Comparisons());
+    stats().OnRandomDraw();
+    stats().OnBytesMoved(len / 2 * sizeof(T));
     std::uniform_int_distribution<int32_t> dist(0, 1);
-    for (int32_t i = dist(*rgen); i < len; i += 2) {
+    const int32_t offset = dist(*rgen);
+    watch_.Compact(keys, len, offset, std::ldexp(1.0, level + sample_height_));
+    for (int32_t i = offset; i < len; i += 2) {
       keys[i / 2] = keys[i];
+      payloads_[LEVEL_START[level] + i / 2] = payloads_[LEVEL_START[level] + i];
     }
     heavies_[level] = true;
     level_sizes_[level] = len / 2;
@@ -125,11 +199,17 @@ struct SampledKll {
     // std::cout << "ShuffleDown" << std::endl;
 
     using std::swap;
+    stats().OnShuffleDown();
+    // Levels move down as the sample height rises, which the watch cannot follow.
+    watch_.Invalidate();
     std::array<T, LEVEL_START[1] - LEVEL_START[0]> purgatory{};
+    PayloadArray<Payload, LEVEL_START[1] - LEVEL_START[0]> purgatory_payloads{};
     int32_t purgatory_size = 0;
     if (!heavies_[0]) {
       std::copy(&data_[LEVEL_START[0]], &data_[LEVEL_START[0] + level_sizes_[0]],
           &purgatory[0]);
+      stats().OnBytesMoved(level_sizes_[0] * sizeof(T));
+      CopyPayloads(payloads_, LEVEL_START[0], level_sizes_[0], &purgatory_payloads, 0);
       swap(purgatory_size, level_sizes_[0]);
     }
     for (int16_t level = 1; level < level_sizes_.size(); ++level) {
@@ -142,11 +222,18 @@ struct SampledKll {
               &data_[LEVEL_START[level - 1] + level_sizes_[level - 1]],
               &data_[LEVEL_START[level + 1]
                   - (LEVEL_START[level] - LEVEL_START[level - 1]) / 2]);
+          stats().OnBytesMoved(level_sizes_[level - 1] * sizeof(T));
+          CopyPayloads(payloads_, LEVEL_START[level - 1], level_sizes_[level - 1],
+              &payloads_,
+              LEVEL_START[level + 1] - (LEVEL_START[level] - LEVEL_START[level - 1]) / 2);
           copied_up = true;
           level_sizes_[level - 1] = 0;
         }
         data_[LEVEL_START[level - 1] + level_sizes_[level - 1]] =
             data_[LEVEL_START[level] + level_sizes_[level] - 1];
+        payloads_[LEVEL_START[level - 1] + level_sizes_[level - 1]] =
+            payloads_[LEVEL_START[level] + level_sizes_[level] - 1];
+        stats().OnBytesMoved(sizeof(T));
         ++level_sizes_[level - 1];
         --level_sizes_[level];
       }
@@ -154,6 +241,12 @@ struct SampledKll {
         std::copy(&data_[LEVEL_START[level + 1]
                       - (LEVEL_START[level] - LEVEL_START[level - 1]) / 2],
             &data_[LEVEL_START[level + 1]], &data_[LEVEL_START[level]]);
+        stats().OnBytesMoved(
+            (LEVEL_START[level] - LEVEL_START[level - 1]) / 2 * sizeof(T));
+        CopyPayloads(payloads_,
+            LEVEL_START[level + 1] - (LEVEL_START[level] - LEVEL_START[level - 1]) / 2,
+            (LEVEL_START[level] - LEVEL_START[level - 1]) / 2, &payloads_,
+            LEVEL_START[level]);
         level_sizes_[level] = (LEVEL_START[level] - LEVEL_START[level - 1]) / 2;
       }
       heavies_[level] = true;
@@ -161,7 +254,7 @@ struct SampledKll {
     ++sample_height_;
     heavies_.reset();
     for (int16_t i = 0; i < purgatory_size; ++i) {
-      Insert(rgen, purgatory[i], sample_height_ - 1);
+      Place(rgen, purgatory[i], sample_height_ - 1, purgatory_payloads[i]);
     }
   }
 
@@ -189,9 +282,20 @@ struct SampledKll {
 
  public:
   template <typename Random>
-  void Insert(Random* rgen, const T& key, int16_t key_height) {
-    using std::swap;
+  void Insert(Random* rgen, const T& key, int16_t key_height,
+      const Payload& payload = Payload()) {
+    Place(rgen, key, key_height, payload);
+    watch_.Add(key, std::ldexp(1.0, key_height));
+    UpdateWatch();
+  }
+
+ private:
+  // Insert, without reporting the key to the watch. Moves of weight that Place causes
+  // are reported by Compress and InsertSample.
+  template <typename Random>
+  void Place(Random* rgen, const T& key, int16_t key_height, const Payload& payload) {
     int16_t destination = key_height - sample_height_;
+    assert(destination < static_cast<int16_t>(level_sizes_.size()));
     while (destination >= 0
         && level_sizes_[destination]
             == LEVEL_START[destination + 1] - LEVEL_START[destination]) {
@@ -204,8 +308,9 @@ struct SampledKll {
 
       } else {
         while (level_sizes_[destination] > 0 && heavies_[destination]) {
-          Insert(rgen, data_[LEVEL_START[destination] + level_sizes_[destination] - 1],
-              key_height + 1);
+          Place(rgen, data_[LEVEL_START[destination] + level_sizes_[destination] - 1],
+              key_height + 1,
+              payloads_[LEVEL_START[destination] + level_sizes_[destination] - 1]);
           --level_sizes_[destination];
         }
         heavies_[destination] = false;
@@ -215,36 +320,114 @@ struct SampledKll {
     }
     if (destination >= 0) {
       data_[LEVEL_START[destination] + level_sizes_[destination]] = key;
+      payloads_[LEVEL_START[destination] + level_sizes_[destination]] = payload;
       level_sizes_[destination] += 1;
       return;
     }
+    InsertSample(rgen, key, 1ll << key_height, payload);
+  }
+
+ public:
+  // Inserts key with an arbitrary weight, such as a (value, count) pair from a
+  // pre-aggregated feed. Each binary digit of weight that is at least as heavy as the
+  // lowest level goes to the level of that weight, and the remaining digits go to the
+  // sampled region in one step, so this takes O(log weight) calls to Insert.
+  template <typename Random>
+  void InsertWeighted(Random* rgen, const T& key, uint64_t weight,
+      const Payload& payload = Payload()) {
+    watch_.Add(key, weight);
+    const auto fits = [this](int height) {
+      return height - sample_height_ < static_cast<int>(level_sizes_.size());
+    };
+    for (int16_t height = 63; height >= std::max<int16_t>(0, sample_height_);
+         --height) {
+      if ((weight >> height) & 1) {
+        SplitHeavy(height, fits, [&](int h) { Place(rgen, key, h, payload); });
+        weight -= uint64_t{1} << height;
+      }
+    }
+    if (weight > 0) InsertSample(rgen, key, weight, payload);
+    UpdateWatch();
+  }
+
+ private:
+  // Adds key to the sampled region, which holds one key standing in for a total weight
+  // less than that of the lowest level. key_weight must also be less than that weight.
+  // The watch already counts key at key_weight, and learns where that weight goes.
+  template <typename Random>
+  void InsertSample(
+      Random* rgen, const T& key, int64_t key_weight, const Payload& payload) {
+    using std::swap;
     const int64_t limit_weight = 1ull << sample_height_;
-    int64_t key_weight = 1ull << key_height;
+    assert(0 < key_weight && key_weight < limit_weight);
     if (sample_weight_ + key_weight <= limit_weight) {
       std::uniform_int_distribution<int64_t> dist(0, sample_weight_ + key_weight - 1);
+      stats().OnRandomDraw();
       if (dist(*rgen) < key_weight) {
+        stats().OnSampleReplacement();
+        watch_.Move(data_[0], key, sample_weight_);
         data_[0] = key;
+        payloads_[0] = payload;
+      } else {
+        watch_.Move(key, data_[0], key_weight);
       }
       sample_weight_ += key_weight;
       if (sample_weight_ == limit_weight) {
         sample_weight_ = 0;
         const auto temp_key = data_[0];
-        Insert(rgen, temp_key, sample_height_);
+        const auto temp_payload = payloads_[0];
+        Place(rgen, temp_key, sample_height_, temp_payload);
       }
       return;
     }
     T mutable_key = key;
+    Payload mutable_payload = payload;
     if (sample_weight_ > key_weight) {
+      stats().OnSampleReplacement();
       swap(sample_weight_, key_weight);
       swap(data_[0], mutable_key);
+      swap(payloads_[0], mutable_payload);
     }
     std::uniform_int_distribution<int64_t> dist(0, limit_weight - 1);
+    stats().OnRandomDraw();
     if (dist(*rgen) < key_weight) {
-      Insert(rgen, mutable_key, sample_height_);
+      watch_.Add(mutable_key, limit_weight - key_weight);
+      Place(rgen, mutable_key, sample_height_, mutable_payload);
+    } else {
+      watch_.Remove(mutable_key, key_weight);
+    }
+  }
+
+ public:
+  // Inserts every key of that into this sketch at its own weight. The sketch with the
+  // larger sample height absorbs the other one, since Insert cannot accept keys heavier
+  // than its top level.
+  template <typename Random>
+  void Merge(Random* rgen, const SampledKll& that) {
+    if (that.sample_height_ > sample_height_) {
+      const WatchedQuantiles<T> watch = watch_;
+      SampledKll result = that;
+      result.watch_ = WatchedQuantiles<T>(16 * CAPACITY);
+      result.Merge(rgen, *this);
+      *this = result;
+      watch_ = watch;
+      watch_.Invalidate();
+      UpdateWatch();
+      return;
+    }
+    for (int16_t level = std::max(0, -that.sample_height_);
+         level < that.level_sizes_.size(); ++level) {
+      for (int32_t i = 0; i < that.level_sizes_[level]; ++i) {
+        Insert(rgen, that.data_[LEVEL_START[level] + i], level + that.sample_height_,
+            that.payloads_[LEVEL_START[level] + i]);
+      }
+    }
+    if (that.sample_weight_) {
+      InsertWeighted(rgen, that.data_[0], that.sample_weight_, that.payloads_[0]);
     }
   }
 };
 
-template <typename T, int32_t CAPACITY>
-constexpr
-    typename SampledKll<T, CAPACITY>::KllArrayType SampledKll<T, CAPACITY>::LEVEL_START;
+template <typename T, int32_t CAPACITY, typename Payload, typename Stats>
+constexpr typename SampledKll<T, CAPACITY, Payload, Stats>::KllArrayType
+    SampledKll<T, CAPACITY, Payload, Stats>::LEVEL_START;
@@ -1,42 +1,304 @@
 #include "sampler.hpp"
+#include "utility.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <random>
-#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Tests that each sampler picks every one of WIDTH steps with equal probability.
+//
+//   sampler-uniformity-test [--width=N] [--trials=N] [--alpha=P] [--threads=N]
+//       [--batch=N] [--seed=N] [--checkpoint=FILE]
+//
+// Each trial runs a fresh sampler for WIDTH steps and counts the last step it picked.
+// Trials run in batches of --batch, spread over threads, and batch b of sampler s
+// draws from an mt19937_64 seeded with (seed, s, b), so the counts do not depend on the
+// number of threads. After every round of batches the harness prints, for each sampler,
+// a chi-square test of the counts and a Kolmogorov-Smirnov test of their cumulative
+// distribution, each with its p-value. The KS p-value comes from the continuous
+// distribution, and so is conservative for these discrete counts.
+//
+// A sampler stops once either p-value falls below --alpha, and fails, or once it has
+// run --trials trials, and passes; --trials=0 runs until one fails. Since the harness
+// tests after every round, alpha should be small; the default is 1e-6. With
+// --checkpoint the counts are written to FILE after every round, and a later run with
+// the same width, seed and batch resumes from them. It exits with 0 if every sampler
+// passed, 1 if one failed, and 2 on errors.
 
 using namespace std;
 using namespace sampler;
 
-template <template<typename N> typename Sampler>
-void Uniformity(size_t width, size_t count) {
-  // DevUrandom<uint64_t> randgen;
-  random_device randgen;
-  vector<size_t> result(width, 0);
-  for (size_t i = 0; i < count; ++i) {
+struct UniformityOptions {
+  size_t width = 96;
+  uint64_t max_trials = 1'000'000;
+  double alpha = 1e-6;
+  unsigned threads = max(1u, thread::hardware_concurrency());
+  uint64_t batch = 10'000;
+  uint64_t seed = 0;
+  string checkpoint;
+};
+
+// Adds to counts the steps that trials samplers of type Sampler pick out of width.
+template <template <typename N> class Sampler>
+void Trials(mt19937_64* rgen, size_t width, uint64_t trials, vector<uint64_t>* counts) {
+  for (uint64_t i = 0; i < trials; ++i) {
     Sampler<unsigned __int128> sampler;
     size_t payload = width;
     for (size_t j = 0; j < width; ++j) {
-      if (sampler.Step(&randgen)) payload = j;
-    }
-    ++result.at(payload);
-    if (i % 1'000'000 == 0) {
-      cout << decltype(sampler)::NAME() << ' ' << right << setw(4) << i / 1'000'000
-           << ' ';
-      long double max_quality = 0.0;
-      for (auto r : result) {
-        max_quality = std::max(max_quality, -log2(std::abs((r / (long double)i) - (1.0 / width))));
-      }
-      cout << left << setw(8) << max_quality << " " << endl;
+      if (sampler.Step(rgen)) payload = j;
     }
+    ++counts->at(payload);
   }
 }
 
+struct Candidate {
+  string name;
+  function<void(mt19937_64*, size_t, uint64_t, vector<uint64_t>*)> trials;
+  vector<uint64_t> counts;
+  uint64_t batches = 0;
+  bool done = false, failed = false;
+};
+
+template <template <typename N> class Sampler>
+Candidate Make() {
+  string name = Sampler<unsigned __int128>::NAME();
+  name.erase(name.find_last_not_of(' ') + 1);
+  return {name, Trials<Sampler>, {}, 0, false, false};
+}
+
+// The probability that a chi-square variable with df degrees of freedom exceeds x: the
+// regularized upper incomplete gamma function Q(df / 2, x / 2), by its series below
+// a + 1 and by its continued fraction above.
+double ChiSquarePValue(double x, double df) {
+  const double a = df / 2, z = x / 2;
+  if (z <= 0) return 1;
+  const double log_prefix = a * log(z) - z - lgamma(a);
+  if (z < a + 1) {
+    double term = 1 / a, sum = term;
+    for (int n = 1; n < 1000 && term > sum * 1e-15; ++n) {
+      term *= z / (a + n);
+      sum += term;
+    }
+    return max(0.0, 1 - sum * exp(log_prefix));
+  }
+  // Lentz's method.
+  const double tiny = 1e-300;
+  double b = z + 1 - a, c = 1 / tiny, d = 1 / b, h = d;
+  for (int n = 1; n < 1000; ++n) {
+    const double an = -n * (n - a);
+    b += 2;
+    d = an * d + b;
+    d = (fabs(d) < tiny) ? tiny : d;
+    c = b + an / c;
+    c = (fabs(c) < tiny) ? tiny : c;
+    d = 1 / d;
+    const double delta = d * c;
+    h *= delta;
+    if (fabs(delta - 1) < 1e-15) break;
+  }
+  return exp(log_prefix) * h;
+}
+
+// The probability that the Kolmogorov-Smirnov statistic of n samples exceeds d, with
+// Stephens' correction for finite n.
+double KolmogorovPValue(double d, double n) {
+  const double lambda = (sqrt(n) + 0.12 + 0.11 / sqrt(n)) * d;
+  if (lambda < 0.2) return 1;
+  double sum = 0;
+  for (int k = 1; k <= 100; ++k) {
+    const double term = exp(-2 * k * k * lambda * lambda);
+    sum += (k % 2 ? 2 : -2) * term;
+    if (term < 1e-16) break;
+  }
+  return min(1.0, max(0.0, sum));
+}
+
+class UniformityHarness {
+  UniformityOptions options_;
+  vector<Candidate> candidates_;
+  mutex lock_;
+
+  // Runs batch of candidate c into counts.
+  void Batch(size_t c, uint64_t batch, vector<uint64_t>* counts) {
+    seed_seq seeds = {static_cast<uint32_t>(options_.seed),
+        static_cast<uint32_t>(options_.seed >> 32), static_cast<uint32_t>(c),
+        static_cast<uint32_t>(batch), static_cast<uint32_t>(batch >> 32)};
+    mt19937_64 r(seeds);
+    candidates_[c].trials(&r, options_.width, options_.batch, counts);
+  }
+
+  // Runs units of work, which are (candidate, batch) pairs, and adds up their counts.
+  // sampler::Sample keeps leftover random bits in a thread_local buffer, so each batch
+  // runs on a thread of its own to keep it from drawing on another batch's stream.
+  void Work(const vector<pair<size_t, uint64_t>>& units, atomic<size_t>* next) {
+    vector<vector<uint64_t>> counts(candidates_.size(),
+        vector<uint64_t>(options_.width));
+    for (size_t i; (i = (*next)++) < units.size();) {
+      thread([&] { Batch(units[i].first, units[i].second, &counts[units[i].first]); })
+          .join();
+    }
+    lock_guard<mutex> guard(lock_);
+    for (size_t c = 0; c < candidates_.size(); ++c) {
+      for (size_t j = 0; j < options_.width; ++j) {
+        candidates_[c].counts[j] += counts[c][j];
+      }
+    }
+  }
+
+  string Header() const {
+    return "sampler-uniformity 1 " + to_string(options_.width) + " "
+        + to_string(options_.seed) + " " + to_string(options_.batch);
+  }
+
+  // Writes to a new file and renames it, so that a crash leaves the old checkpoint.
+  void Save() const {
+    const string temporary = options_.checkpoint + ".new";
+    {
+      ofstream out(temporary);
+      out << Header() << '\n';
+      for (const auto& candidate : candidates_) {
+        out << candidate.name << ' ' << candidate.batches;
+        for (const uint64_t count : candidate.counts) out << ' ' << count;
+        out << '\n';
+      }
+      if (!out) throw runtime_error("cannot write " + temporary);
+    }
+    if (rename(temporary.c_str(), options_.checkpoint.c_str()) != 0) {
+      throw runtime_error("cannot rename " + temporary);
+    }
+  }
+
+  void Load() {
+    ifstream in(options_.checkpoint);
+    string header;
+    if (!getline(in, header)) return;
+    if (header != Header()) {
+      throw runtime_error(options_.checkpoint + " has another width, seed or batch");
+    }
+    string name;
+    uint64_t batches;
+    while (in >> name >> batches) {
+      vector<uint64_t> counts(options_.width);
+      for (auto& count : counts) in >> count;
+      for (auto& candidate : candidates_) {
+        if (candidate.name != name) continue;
+        candidate.batches = batches;
+        candidate.counts = counts;
+      }
+    }
+  }
+
+  uint64_t Trials(const Candidate& candidate) const {
+    return candidate.batches * options_.batch;
+  }
+
+  // Prints the tests of candidate's counts, and decides whether it is done.
+  void Test(Candidate* candidate) const {
+    const double n = Trials(*candidate), expected = n / options_.width;
+    double chi_square = 0, d = 0, cumulative = 0;
+    for (size_t j = 0; j < options_.width; ++j) {
+      const double count = candidate->counts[j];
+      chi_square += (count - expected) * (count - expected) / expected;
+      cumulative += count;
+      d = max(d, fabs(cumulative / n - (j + 1.0) / options_.width));
+    }
+    const double chi_p = ChiSquarePValue(chi_square, options_.width - 1.0);
+    const double ks_p = KolmogorovPValue(d, n);
+    candidate->failed = min(chi_p, ks_p) < options_.alpha;
+    candidate->done = candidate->failed
+        || (options_.max_trials > 0 && Trials(*candidate) >= options_.max_trials);
+    cout << left << setw(16) << candidate->name << right << setw(12) << Trials(*candidate)
+         << fixed << setprecision(2) << setw(12) << chi_square << scientific
+         << setprecision(3) << setw(12) << chi_p << setw(12) << d << setw(12) << ks_p
+         << "  " << (candidate->failed ? "FAIL" : candidate->done ? "pass" : "")
+         << defaultfloat << endl;
+  }
 
-int main() {
-  constexpr size_t width = 96, count = numeric_limits<size_t>::max();
-  auto f1 = async(launch::async, Uniformity<Li>, width, count);
-  auto f2 = async(launch::async, Uniformity<Simple>, width, count);
-  auto f3 = async(launch::async, Uniformity<Vitter>, width, count);
+ public:
+  UniformityHarness(const UniformityOptions& options, vector<Candidate> candidates)
+      : options_(options), candidates_(move(candidates)) {
+    for (auto& candidate : candidates_) candidate.counts.assign(options_.width, 0);
+    if (!options_.checkpoint.empty()) Load();
+  }
+
+  // Returns whether every sampler passed.
+  bool Run() {
+    cout << left << setw(16) << "sampler" << right << setw(12) << "trials" << setw(12)
+         << "chi-square" << setw(12) << "p" << setw(12) << "KS" << setw(12) << "p"
+         << endl;
+    for (auto& candidate : candidates_) {
+      if (candidate.batches > 0) Test(&candidate);
+    }
+    // Enough batches per round to keep every thread busy for a while.
+    const uint64_t per_round = 4 * options_.threads;
+    while (any_of(candidates_.begin(), candidates_.end(),
+        [](const Candidate& c) { return !c.done; })) {
+      vector<pair<size_t, uint64_t>> units;
+      for (size_t c = 0; c < candidates_.size(); ++c) {
+        if (candidates_[c].done) continue;
+        uint64_t end = candidates_[c].batches + per_round;
+        if (options_.max_trials > 0) {
+          end = min(end, (options_.max_trials + options_.batch - 1) / options_.batch);
+        }
+        for (uint64_t b = candidates_[c].batches; b < end; ++b) units.push_back({c, b});
+        candidates_[c].batches = end;
+      }
+      atomic<size_t> next(0);
+      vector<thread> workers;
+      const size_t threads = min<size_t>(options_.threads, units.size());
+      for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&] { Work(units, &next); });
+      }
+      for (auto& worker : workers) worker.join();
+      for (auto& candidate : candidates_) {
+        if (!candidate.done) Test(&candidate);
+      }
+      if (!options_.checkpoint.empty()) Save();
+    }
+    return none_of(candidates_.begin(), candidates_.end(),
+        [](const Candidate& c) { return c.failed; });
+  }
+};
+
+int main(int argc, char** argv) {
+  UniformityOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const string arg = argv[i];
+    const auto value = [&](const char* flag) { return FlagValue(arg, flag); };
+    if (!value("--width=").empty()) {
+      options.width = max<size_t>(2, StringCast<size_t>(value("--width=")));
+    } else if (!value("--trials=").empty()) {
+      options.max_trials = StringCast<uint64_t>(value("--trials="));
+    } else if (!value("--alpha=").empty()) {
+      options.alpha = StringCast<double>(value("--alpha="));
+    } else if (!value("--threads=").empty()) {
+      options.threads = max(1u, StringCast<unsigned>(value("--threads=")));
+    } else if (!value("--batch=").empty()) {
+      options.batch = max<uint64_t>(1, StringCast<uint64_t>(value("--batch=")));
+    } else if (!value("--seed=").empty()) {
+      options.seed = StringCast<uint64_t>(value("--seed="));
+    } else if (!value("--checkpoint=").empty()) {
+      options.checkpoint = value("--checkpoint=");
+    } else {
+      return UsageError("unknown argument " + arg);
+    }
+  }
+  try {
+    // To test another sampler, add it here.
+    UniformityHarness harness(options, {Make<Simple>(), Make<Li>(), Make<Vitter>()});
+    return harness.Run() ? 0 : 1;
+  } catch (const exception& e) {
+    cerr << e.what() << endl;
+    return 2;
+  }
 }
@@ -0,0 +1,125 @@
+#include "check.hpp"
+#include "shared-sketch.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+using Sketch = SharedSketch<uint64_t, 400, 3>;
+
+// Each of WORKERS workers inserts the keys j * WORKERS + worker for j < KEYS.
+constexpr uint64_t WORKERS = 3, KEYS = 200000, PUBLISH_EVERY = 1000;
+
+// Runs a worker in a child process that inserts its keys from begin to end, and writes
+// 'c' to report once it has claimed a shard. If end < KEYS, it then publishes, writes
+// 'h' and waits to be killed.
+pid_t Worker(const string& path, int report, uint64_t worker, uint64_t begin,
+    uint64_t end) {
+  const pid_t pid = fork();
+  Check(pid >= 0, "fork");
+  if (pid > 0) return pid;
+  {
+    mt19937_64 r(worker * KEYS + begin);
+    Sketch sketch(path);
+    Sketch::Writer writer(&r, &sketch);
+    Check(write(report, "c", 1) == 1, "report");
+    for (uint64_t j = begin; j < end; ++j) {
+      writer.Insert(&r, j * WORKERS + worker);
+      if (j % PUBLISH_EVERY == 0) writer.Publish();
+    }
+    if (end < KEYS) {
+      writer.Publish();
+      Check(write(report, "h", 1) == 1, "report");
+      while (true) pause();
+    }
+  }
+  _exit(0);
+}
+
+int main() {
+  char name[] = "/tmp/shared-sketch-test-XXXXXX";
+  const int fd = mkstemp(name);
+  Check(fd >= 0, "temporary file");
+  close(fd);
+  const string path = name;
+  Sketch sketch(path);
+  bool refused = false;
+  try {
+    SharedSketch<uint64_t, 200, 3> other(path);
+  } catch (const runtime_error&) {
+    refused = true;
+  }
+  Check(refused, "another layout");
+
+  // A host may be asked before any worker publishes.
+  refused = false;
+  try {
+    sketch.GetCdf();
+  } catch (const runtime_error&) {
+    refused = true;
+  }
+  Check(refused, "nothing published");
+  Check(sketch.GetWeightedCdf().Total() == 0, "empty weighted summary");
+
+  int pipes[2];
+  Check(pipe(pipes) == 0, "pipe");
+  const pid_t doomed = Worker(path, pipes[1], 0, 0, KEYS / 2);
+  for (uint64_t worker = 1; worker < WORKERS; ++worker) {
+    Worker(path, pipes[1], worker, 0, KEYS);
+  }
+  int claimed = 0;
+  bool halfway = false;
+  while (claimed < WORKERS || !halfway) {
+    char c;
+    Check(read(pipes[0], &c, 1) == 1, "read report");
+    claimed += c == 'c';
+    halfway = halfway || c == 'h';
+  }
+  mt19937_64 r(WORKERS);
+  refused = false;
+  try {
+    Sketch::Writer extra(&r, &sketch);
+  } catch (const runtime_error&) {
+    refused = true;
+  }
+  Check(refused || sketch.Writers() < WORKERS, "every shard taken");
+
+  // Reads while the others write.
+  for (int i = 0; i < 200; ++i) {
+    const double total = sketch.GetCdf().Total();
+    Check(KEYS / 2 * 0.95 <= total && total <= WORKERS * KEYS * 1.05, "partial total");
+  }
+
+  // The replacement claims the dead worker's shard, or a finished worker's, and carries
+  // on with what that shard published.
+  kill(doomed, SIGKILL);
+  waitpid(doomed, nullptr, 0);
+  Worker(path, pipes[1], 0, KEYS / 2, KEYS);
+  while (wait(nullptr) > 0) {}
+  Check(sketch.Writers() == 0, "writers gone");
+
+  const auto cdf = sketch.GetCdf();
+  const double n = WORKERS * KEYS;
+  Check(fabs(cdf.Total() / n - 1) < 0.02, "total");
+  for (int p = 1; p < 100; ++p) {
+    Check(fabs(100 * cdf.GetValue(p) / n - p) < 2, "percentile");
+  }
+  // The same merge with integer weights, as a host ships it to a federated query.
+  const auto weighted = sketch.GetWeightedCdf();
+  Check(weighted.Total() == cdf.Total(), "weighted total");
+  for (int p = 1; p < 100; ++p) {
+    Check(weighted.GetValue(p) == cdf.GetValue(p), "weighted percentile");
+  }
+  remove(name);
+  cout << "OK" << endl;
+}
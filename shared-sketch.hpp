@@ -0,0 +1,260 @@
+#pragma once
+
+/// A quantile sketch of arithmetic keys that the worker processes of a host build
+/// together in a shared memory segment, such as a file in /dev/shm.
+///
+/// The segment is a file that every process maps with mmap. It holds a header, which
+/// records the layout so that processes built with other parameters refuse the file,
+/// and SHARDS shards of fixed size. It holds offsets rather than pointers, so each
+/// process may map it at any address. A worker claims a shard by constructing a
+/// SharedSketch::Writer, which compare-and-swaps the worker's pid into the shard's
+/// owner, and keeps a private SampledKll<T, CAPACITY> that Publish() copies, as (key,
+/// weight) pairs, into the shard.
+///
+/// Each shard has two slots, each guarded by a sequence lock. Publish() fills the slot
+/// that readers are not pointed at and then points them at it, so readers retry only
+/// when a writer publishes twice while they read, and never wait for a writer, even one
+/// that died while publishing. GetCdf() reads the current slot of every shard in place
+/// and merges them, so any process may ask for host-wide quantiles without asking the
+/// workers for anything.
+///
+/// A shard keeps what it published after its owner exits or dies. The next writer to
+/// claim it, such as the worker after a restart, loads those keys into its own sketch
+/// before it inserts more, so they are neither lost nor counted twice. A dead owner is
+/// one whose pid no longer names a process, so a shard is not reclaimed while its pid is
+/// reused by another process.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "payload.hpp"
+#include "sampled-kll.hpp"
+#include "utility.hpp"
+#include "weighted-cdf.hpp"
+
+template <typename T, int32_t CAPACITY, uint32_t SHARDS>
+class SharedSketch {
+  static_assert(std::is_arithmetic<T>::value, "shared sketches hold arithmetic keys");
+  static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+      "only lock-free atomics work across processes");
+
+  struct Header {
+    uint64_t magic;
+    uint32_t key_bytes, key_kind, capacity, shards;
+
+    bool operator==(const Header& that) const {
+      return magic == that.magic && key_bytes == that.key_bytes
+          && key_kind == that.key_kind && capacity == that.capacity
+          && shards == that.shards;
+    }
+  };
+
+  struct Entry {
+    T key;
+    uint64_t weight;
+  };
+
+  struct Slot {
+    // Odd while a writer fills the slot.
+    std::atomic<uint64_t> sequence;
+    uint32_t size;
+    Entry entries[CAPACITY];
+  };
+
+  struct alignas(64) Shard {
+    // The pid of the writer, or 0 if there is none.
+    std::atomic<int32_t> owner;
+    // The slot that readers read.
+    std::atomic<uint32_t> current;
+    Slot slots[2];
+  };
+
+  struct Segment {
+    Header header;
+    Shard shards[SHARDS];
+  };
+
+  Segment* segment_;
+
+  static Header Expected() {
+    // "kll-shm1"
+    return {0x6b6c6c2d73686d31, sizeof(T),
+        2u * std::is_floating_point<T>::value + std::is_signed<T>::value, CAPACITY,
+        SHARDS};
+  }
+
+  static bool Alive(int32_t pid) { return kill(pid, 0) == 0 || errno != ESRCH; }
+
+  // Claims a shard that is free or whose owner has died, or returns nullptr.
+  Shard* Claim(int32_t pid) {
+    for (auto& shard : segment_->shards) {
+      int32_t owner = shard.owner.load();
+      if ((owner == 0 || !Alive(owner))
+          && shard.owner.compare_exchange_strong(owner, pid)) {
+        return &shard;
+      }
+    }
+    return nullptr;
+  }
+
+  // Appends the pairs that shard last published to raw. The copy may race with a writer
+  // that reuses the slot, as in any sequence lock, and is thrown away if it did.
+  static void Read(const Shard& shard, std::vector<std::pair<T, int64_t>>* raw) {
+    const size_t start = raw->size();
+    while (true) {
+      const Slot& slot = shard.slots[shard.current.load(std::memory_order_acquire)];
+      const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence % 2 == 1) continue;
+      const uint32_t size = std::min<uint32_t>(slot.size, CAPACITY);
+      for (uint32_t i = 0; i < size; ++i) {
+        const Entry& entry = slot.entries[i];
+        raw->push_back({entry.key, static_cast<int64_t>(entry.weight)});
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) == sequence) return;
+      raw->resize(start);
+    }
+  }
+
+ public:
+  // Maps the segment in the file at path, and formats the file if it is new.
+  explicit SharedSketch(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd < 0) throw std::runtime_error("cannot open " + path);
+    const auto fail = [fd, &path](const std::string& why) {
+      flock(fd, LOCK_UN);
+      close(fd);
+      throw std::runtime_error(path + ": " + why);
+    };
+    // Keeps other processes from mapping a new file before it is formatted.
+    if (flock(fd, LOCK_EX) != 0) fail("cannot lock");
+    struct stat status;
+    if (fstat(fd, &status) != 0) fail("cannot stat");
+    const bool fresh = status.st_size == 0;
+    if (fresh && ftruncate(fd, sizeof(Segment)) != 0) fail("cannot resize");
+    if (!fresh && static_cast<size_t>(status.st_size) != sizeof(Segment)) {
+      fail("has another layout");
+    }
+    void* memory =
+        mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) fail("cannot map");
+    segment_ = static_cast<Segment*>(memory);
+    if (fresh) {
+      new (memory) Segment();
+      segment_->header = Expected();
+    }
+    // The mapping keeps the file open, and so would keep it locked.
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (!(segment_->header == Expected())) {
+      munmap(segment_, sizeof(Segment));
+      throw std::runtime_error(path + ": has another layout");
+    }
+  }
+
+  ~SharedSketch() { munmap(segment_, sizeof(Segment)); }
+
+  SharedSketch(const SharedSketch&) = delete;
+  SharedSketch& operator=(const SharedSketch&) = delete;
+
+  // The number of shards whose owner is alive.
+  uint32_t Writers() const {
+    uint32_t result = 0;
+    for (const auto& shard : segment_->shards) {
+      const int32_t owner = shard.owner.load();
+      result += owner != 0 && Alive(owner);
+    }
+    return result;
+  }
+
+  // The merge of what every shard last published. A host may be asked before any worker
+  // has published, and then there is no Cdf to give: this throws std::runtime_error.
+  Cdf<T> GetCdf() const {
+    std::vector<std::pair<T, int64_t>> raw;
+    for (const auto& shard : segment_->shards) Read(shard, &raw);
+    if (raw.empty()) throw std::runtime_error("no worker has published keys");
+    PayloadVector<NoPayload> payloads;
+    SortWithPayloads(raw.data(), raw.size(), &payloads, 0);
+    return Cdf<T>(raw, payloads);
+  }
+
+  // The same merge with integer weights, for shipping to another host. Before any worker
+  // publishes, it is empty, with Total() == 0, and merges with other hosts' as nothing.
+  WeightedCdf<T> GetWeightedCdf() const {
+    std::vector<std::pair<T, int64_t>> raw;
+    for (const auto& shard : segment_->shards) Read(shard, &raw);
+    return WeightedCdf<T>::FromUnsorted(std::move(raw));
+  }
+
+  // One worker's shard of the segment, which the worker owns until the writer is
+  // destroyed.
+  class Writer {
+    Shard* shard_;
+    SampledKll<T, CAPACITY> kll_;
+
+   public:
+    // Claims a free shard, or the shard of a dead worker, and loads what it published.
+    // Throws if every shard has a live owner.
+    template <typename Random>
+    Writer(Random* rgen, SharedSketch* sketch) : shard_(sketch->Claim(getpid())) {
+      if (shard_ == nullptr) throw std::runtime_error("every shard has an owner");
+      std::vector<std::pair<T, int64_t>> raw;
+      Read(*shard_, &raw);
+      for (const auto& p : raw) kll_.InsertWeighted(rgen, p.first, p.second);
+    }
+
+    // Publishes, and gives up the shard.
+    ~Writer() {
+      Publish();
+      shard_->owner.store(0);
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    template <typename Random>
+    void Insert(Random* rgen, T key, int16_t key_height = 0) {
+      kll_.Insert(rgen, key, key_height);
+    }
+
+    template <typename Random>
+    void InsertWeighted(Random* rgen, T key, uint64_t weight) {
+      kll_.InsertWeighted(rgen, key, weight);
+    }
+
+    // The private sketch, which holds keys that are not yet published.
+    const SampledKll<T, CAPACITY>& Local() const { return kll_; }
+
+    // Makes every key inserted so far visible to readers, in O(CAPACITY) time.
+    void Publish() {
+      const uint32_t next = 1 - shard_->current.load(std::memory_order_relaxed);
+      Slot& slot = shard_->slots[next];
+      // A writer that died while filling the slot left its sequence odd.
+      const uint64_t sequence = slot.sequence.load(std::memory_order_relaxed) | 1;
+      slot.sequence.store(sequence, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      uint32_t size = 0;
+      kll_.ForEachKey([&](const T& key, int64_t weight, const NoPayload&) {
+        slot.entries[size++] = {key, static_cast<uint64_t>(weight)};
+      });
+      slot.size = size;
+      slot.sequence.store(sequence + 1, std::memory_order_release);
+      shard_->current.store(next, std::memory_order_release);
+    }
+  };
+};
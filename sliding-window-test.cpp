@@ -0,0 +1,38 @@
+#include "kll.hpp"
+#include "sampled-kll.hpp"
+#include "sliding-window.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+using namespace std;
+
+// Each tick t receives the keys [1000 * t, 1000 * (t + 1)), so the median of a window of
+// the b newest ticks is known exactly.
+template <typename Sketch>
+void Check(const char* name) {
+  constexpr int32_t BUCKETS = 12;
+  SlidingWindow<Sketch, BUCKETS> window;
+  mt19937_64 r(2718);
+  for (int tick = 0; tick < 40; ++tick) {
+    window.AdvanceTo(tick);
+    for (int i = 0; i < 1000; ++i) window.Insert(&r, 1000 * tick + i, 0);
+    for (int buckets = 1; buckets <= min(BUCKETS, tick + 1); ++buckets) {
+      const double expected = 1000.0 * (tick + 1) - 500.0 * buckets;
+      const double actual = window.GetCdf(&r, buckets).GetValue(50.0);
+      if (abs(actual - expected) > 50.0 * buckets) {
+        cerr << name << " tick " << tick << " buckets " << buckets << ": " << actual
+             << " != " << expected << endl;
+        exit(1);
+      }
+    }
+  }
+  cout << "OK " << name << endl;
+}
+
+int main() {
+  Check<SampledKll<int, 200>>("SampledKll");
+  Check<Kll<int, 200>>("Kll");
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+/// A sliding-window wrapper around a mergeable quantile sketch.
+///
+/// The class SlidingWindow<Sketch, B> splits the stream into intervals (for instance,
+/// one per second) and keeps one Sketch per interval in a ring of B buckets. Inserts go
+/// to the open bucket. Advance() seals it, expires the oldest bucket and opens a new
+/// one in its place, so a window covers at most the B newest intervals.
+///
+/// The buckets are the leaves of a bottom-up segment tree whose internal nodes cache the
+/// merge of their two children. A query over the b newest buckets merges the
+/// O(log B) cached nodes that cover the sealed part of the window, plus the open
+/// bucket, instead of all b buckets. Advancing resets one leaf and marks its stale
+/// ancestors; the cached merges are only rebuilt by the next query that needs them.
+///
+/// Sketch must provide Insert(rgen, key, height), Merge(rgen, Sketch), and GetCdf().
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+#include "utility.hpp"
+
+template <typename Sketch, int32_t BUCKETS>
+struct SlidingWindow {
+ private:
+  static_assert(BUCKETS > 0, "a window needs at least one bucket");
+
+  // nodes_[1] is the root and nodes_[BUCKETS + i] is the bucket at ring position i. Node
+  // i > 0 covers the union of nodes 2i and 2i + 1; this works for any BUCKETS, not just
+  // powers of two.
+  std::vector<Sketch> nodes_;
+  std::vector<bool> stale_;
+  int32_t open_ = 0;
+  uint64_t tick_ = 0;
+
+  // Marks the ancestors of bucket as needing a rebuild. A stale node only has stale
+  // ancestors, so the walk stops at the first node that is already stale; each step is
+  // paid for by the merge that made that node fresh, so this is O(1) amortized.
+  void Invalidate(int32_t bucket) {
+    for (int32_t i = (BUCKETS + bucket) / 2; i > 0 && !stale_[i]; i /= 2) {
+      stale_[i] = true;
+    }
+  }
+
+  template <typename Random>
+  const Sketch& Node(Random* rgen, int32_t i) {
+    if (i < BUCKETS && stale_[i]) {
+      nodes_[i] = Node(rgen, 2 * i);
+      nodes_[i].Merge(rgen, Node(rgen, 2 * i + 1));
+      stale_[i] = false;
+    }
+    return nodes_[i];
+  }
+
+  // Merges the sealed buckets at ring positions [begin, end) into result.
+  template <typename Random>
+  void MergeRange(Random* rgen, int32_t begin, int32_t end, Sketch* result) {
+    for (begin += BUCKETS, end += BUCKETS; begin < end; begin /= 2, end /= 2) {
+      if (begin & 1) result->Merge(rgen, Node(rgen, begin++));
+      if (end & 1) result->Merge(rgen, Node(rgen, --end));
+    }
+  }
+
+ public:
+  explicit SlidingWindow() : nodes_(2 * BUCKETS), stale_(BUCKETS, true) {}
+
+  // The tick covered by the open bucket; it starts at zero and each Advance() adds one.
+  uint64_t Tick() const { return tick_; }
+
+  // Includes the cached merges, which can hold as much as the buckets themselves.
+  size_t MemoryUsage() const {
+    size_t result = sizeof(*this) + (nodes_.capacity() - nodes_.size()) * sizeof(Sketch)
+        + (stale_.capacity() + CHAR_BIT - 1) / CHAR_BIT;
+    for (const auto& node : nodes_) result += node.MemoryUsage();
+    return result;
+  }
+
+  template <typename Random, typename Key>
+  void Insert(Random* rgen, const Key& key, int16_t height) {
+    nodes_[BUCKETS + open_].Insert(rgen, key, height);
+  }
+
+  // Seals the open bucket and replaces the oldest bucket with an empty one.
+  void Advance() {
+    Invalidate(open_);
+    open_ = (open_ + 1) % BUCKETS;
+    nodes_[BUCKETS + open_] = Sketch();
+    Invalidate(open_);
+    ++tick_;
+  }
+
+  // Advances until the open bucket covers tick, for time-bucketed streams in which the
+  // caller maps a clock reading to a tick, such as seconds since some epoch. Ticks
+  // earlier than the current one are ignored.
+  void AdvanceTo(uint64_t tick) {
+    if (tick <= tick_) return;
+    const uint64_t steps = tick - tick_;
+    for (uint64_t i = 0; i < std::min<uint64_t>(steps, BUCKETS); ++i) Advance();
+    tick_ = tick;
+  }
+
+  // Returns the merge of the open bucket and the buckets - 1 buckets sealed just before
+  // it.
+  template <typename Random>
+  Sketch Window(Random* rgen, int32_t buckets = BUCKETS) {
+    assert(0 < buckets && buckets <= BUCKETS);
+    Sketch result = nodes_[BUCKETS + open_];
+    const int32_t begin = (open_ - (buckets - 1) + BUCKETS) % BUCKETS;
+    if (begin <= open_) {
+      MergeRange(rgen, begin, open_, &result);
+    } else {
+      MergeRange(rgen, begin, BUCKETS, &result);
+      MergeRange(rgen, 0, open_, &result);
+    }
+    return result;
+  }
+
+  template <typename Random>
+  auto GetCdf(Random* rgen, int32_t buckets = BUCKETS) {
+    return Window(rgen, buckets).GetCdf();
+  }
+};
@@ -0,0 +1,69 @@
+#include "numeric-sort.hpp"
+#include "utility.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace numeric_sort;
+
+// Times every kernel that supports T against std::sort, on random keys and on keys
+// whose high bytes are all the same, like latencies in nanoseconds. Prints nanoseconds
+// per key.
+template <typename T>
+void Compare(const char* name, uint64_t keys_per_size) {
+  mt19937_64 r(0);
+  for (const size_t size : {16, 64, 256, 1024, 4096, 65536}) {
+    for (const bool narrow : {false, true}) {
+      const size_t rounds = max<size_t>(1, keys_per_size / size);
+      vector<T> input(rounds * size);
+      for (auto& key : input) {
+        const uint64_t bits = narrow ? r() % 1'000'000 : r();
+        if (is_floating_point<T>::value && !narrow) {
+          memcpy(&key, &bits, sizeof(key));
+          if (key != key) key = 0;
+        } else {
+          key = static_cast<T>(bits);
+        }
+      }
+      cout << left << setw(9) << name << setw(7) << size << setw(8)
+           << (narrow ? "narrow" : "random");
+      for (const auto kernel : {Kernel::STD, Kernel::RADIX, Kernel::SCALAR_NETWORK,
+               Kernel::SSE2_NETWORK, Kernel::AVX2_NETWORK}) {
+        if (!Available<T>(kernel)) {
+          cout << right << setw(18) << "-";
+          continue;
+        }
+        vector<T> keys = input;
+        const auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < rounds; ++i) {
+          Sort(&keys[i * size], &keys[i * size] + size, kernel);
+        }
+        const auto nanos = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count();
+        cout << right << setw(18) << fixed << setprecision(2)
+             << static_cast<double>(nanos) / keys.size();
+      }
+      cout << endl;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  const uint64_t keys_per_size = (argc > 1) ? StringCast<uint64_t>(argv[1]) : 1 << 22;
+  cout << left << setw(9) << "type" << setw(7) << "size" << setw(8) << "keys";
+  for (const auto kernel : {Kernel::STD, Kernel::RADIX, Kernel::SCALAR_NETWORK,
+           Kernel::SSE2_NETWORK, Kernel::AVX2_NETWORK}) {
+    cout << right << setw(18) << KernelName(kernel);
+  }
+  cout << endl;
+  Compare<float>("float", keys_per_size);
+  Compare<double>("double", keys_per_size);
+  Compare<uint32_t>("uint32_t", keys_per_size);
+  Compare<int64_t>("int64_t", keys_per_size);
+  Compare<uint64_t>("uint64_t", keys_per_size);
+}
@@ -0,0 +1,159 @@
+// Bitonic sorting networks and merges over SIMD registers.
+//
+// This file is written once against a traits class S and is included by
+// numeric-sort.hpp inside one namespace per instruction set, each compiled for that
+// instruction set, so it deliberately has no include guard and includes nothing itself.
+//
+// S provides:
+//
+//   T, V, LANES         the key type, the register type, and the number of keys in a V
+//   Load(const T*)      loads LANES keys, unaligned
+//   Store(T*, V)        stores LANES keys, unaligned
+//   Min(V, V), Max(V, V)
+//   Exchange(V, std::integral_constant<int, J>)
+//                       swaps lane i with lane i ^ J, for each power of two J < LANES
+//   Blend<MASK>(V a, V b)
+//                       takes lane i from b if bit i of MASK is set and from a otherwise
+//   Reverse(V)          reverses the order of the lanes
+//   Greatest()          a key no smaller than any other, used to pad partial registers
+//
+// Sort() sorts each register with a bitonic network, then merges runs of registers
+// bottom-up with a bitonic merge network of two registers, following Inoue and Taura,
+// "SIMD- and cache-friendly algorithm for sorting an array of structures", VLDB 2015.
+
+// Bit i of the result is set if lane i keeps the larger key in the bitonic network
+// stage that compares lanes J apart within blocks of K lanes. Blocks alternate between
+// ascending and descending order, and in an ascending block the lower lane of each pair
+// keeps the smaller key.
+constexpr int BitonicMask(int lanes, int k, int j) {
+  int mask = 0;
+  for (int i = 0; i < lanes; ++i) {
+    if (((i & j) != 0) != ((i & k) != 0)) mask |= 1 << i;
+  }
+  return mask;
+}
+
+template <typename S, int K, int J>
+typename S::V BitonicStage(typename S::V v) {
+  const typename S::V w = S::Exchange(v, std::integral_constant<int, J>());
+  return S::template Blend<BitonicMask(S::LANES, K, J)>(S::Min(v, w), S::Max(v, w));
+}
+
+// Runs the stages of blocks of K lanes that compare lanes J, J / 2, ..., 1 apart. The
+// tag says whether there are any such stages left.
+template <typename S, int K, int J>
+typename S::V BitonicMerge(typename S::V v, std::false_type) {
+  return v;
+}
+
+template <typename S, int K, int J>
+typename S::V BitonicMerge(typename S::V v, std::true_type) {
+  return BitonicMerge<S, K, J / 2>(
+      BitonicStage<S, K, J>(v), std::integral_constant<bool, (J / 2 > 0)>());
+}
+
+template <typename S, int K, int J>
+typename S::V BitonicMerge(typename S::V v) {
+  return BitonicMerge<S, K, J>(v, std::integral_constant<bool, (J > 0)>());
+}
+
+// Sorts blocks of K lanes, alternating between ascending and descending blocks. The tag
+// says whether K > 1.
+template <typename S, int K>
+typename S::V SortRegister(typename S::V v, std::false_type) {
+  return v;
+}
+
+template <typename S, int K>
+typename S::V SortRegister(typename S::V v, std::true_type) {
+  return BitonicMerge<S, K, K / 2>(
+      SortRegister<S, K / 2>(v, std::integral_constant<bool, (K / 2 > 1)>()));
+}
+
+template <typename S>
+typename S::V SortRegister(typename S::V v) {
+  return SortRegister<S, S::LANES>(v, std::integral_constant<bool, (S::LANES > 1)>());
+}
+
+// Given two sorted registers, leaves the smaller half of their keys in lo and the larger
+// half in hi, both sorted.
+template <typename S>
+void MergeRegisters(typename S::V* lo, typename S::V* hi) {
+  // lo followed by the reverse of hi is bitonic, so the first stage of the merge network
+  // splits it into two bitonic halves with no key of the first larger than any key of
+  // the second. Stages over blocks of 2 * LANES lanes then sort each half ascending.
+  const typename S::V reversed = S::Reverse(*hi);
+  const typename S::V smaller = S::Min(*lo, reversed), larger = S::Max(*lo, reversed);
+  *lo = BitonicMerge<S, 2 * S::LANES, S::LANES / 2>(smaller);
+  *hi = BitonicMerge<S, 2 * S::LANES, S::LANES / 2>(larger);
+}
+
+// Merges the sorted runs [x, x + x_size) and [y, y + y_size) into out. Both sizes must
+// be positive multiples of LANES.
+template <typename S>
+void MergeRuns(const typename S::T* x, size_t x_size, const typename S::T* y,
+    size_t y_size, typename S::T* out) {
+  const typename S::T* const x_end = x + x_size;
+  const typename S::T* const y_end = y + y_size;
+  typename S::V lo = S::Load(x), hi = S::Load(y);
+  x += S::LANES;
+  y += S::LANES;
+  MergeRegisters<S>(&lo, &hi);
+  S::Store(out, lo);
+  out += S::LANES;
+  // hi holds the largest keys seen so far. The next register to merge with it is the
+  // one from the run whose next key is smaller, so no key left in either run can
+  // belong before the keys stored from lo.
+  while (x < x_end && y < y_end) {
+    if (*x < *y) {
+      lo = S::Load(x);
+      x += S::LANES;
+    } else {
+      lo = S::Load(y);
+      y += S::LANES;
+    }
+    MergeRegisters<S>(&lo, &hi);
+    S::Store(out, lo);
+    out += S::LANES;
+  }
+  for (; x < x_end; x += S::LANES, out += S::LANES) {
+    lo = S::Load(x);
+    MergeRegisters<S>(&lo, &hi);
+    S::Store(out, lo);
+  }
+  for (; y < y_end; y += S::LANES, out += S::LANES) {
+    lo = S::Load(y);
+    MergeRegisters<S>(&lo, &hi);
+    S::Store(out, lo);
+  }
+  S::Store(out, hi);
+}
+
+template <typename S>
+void Sort(typename S::T* first, typename S::T* last) {
+  using T = typename S::T;
+  const size_t size = last - first;
+  const size_t padded = (size + S::LANES - 1) / S::LANES * S::LANES;
+  thread_local std::vector<T> scratch;
+  if (scratch.size() < 2 * padded) scratch.resize(2 * padded);
+  T* from = scratch.data();
+  T* to = from + padded;
+  std::copy(first, last, from);
+  std::fill(from + size, from + padded, S::Greatest());
+  for (size_t i = 0; i < padded; i += S::LANES) {
+    S::Store(from + i, SortRegister<S>(S::Load(from + i)));
+  }
+  for (size_t width = S::LANES; width < padded; width *= 2) {
+    for (size_t i = 0; i < padded; i += 2 * width) {
+      const size_t middle = std::min(i + width, padded);
+      const size_t end = std::min(i + 2 * width, padded);
+      if (middle == end) {
+        std::copy(from + i, from + end, to + i);
+      } else {
+        MergeRuns<S>(from + i, middle - i, from + middle, end - middle, to + i);
+      }
+    }
+    std::swap(from, to);
+  }
+  std::copy(from, from + size, first);
+}
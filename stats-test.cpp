@@ -0,0 +1,76 @@
+#include "kll.hpp"
+#include "req.hpp"
+#include "sampled-kll.hpp"
+#include "stats.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+using namespace std;
+
+void Print(const char* name, const SketchStats& stats) {
+  cout << name << ":";
+  for (int level = 0; level < SketchStats::MAX_LEVELS; ++level) {
+    if (stats.compactions[level] == 0) continue;
+    cout << " L" << level << "=" << stats.compactions[level] << "/"
+         << stats.compacted_keys[level];
+  }
+  cout << "\n  shuffle_downs " << stats.shuffle_downs << " sample_replacements "
+       << stats.sample_replacements << " random_draws " << stats.random_draws
+       << " bytes_moved " << stats.bytes_moved << " comparisons " << stats.comparisons
+       << endl;
+}
+
+// Counting must not change what the sketch does: with the same seed, the counted and
+// the uncounted sketch must answer every quantile the same way.
+template <template <typename, typename> class Sketch>
+void Check(const char* name, bool samples) {
+  Sketch<NoStats, NoPayload> plain;
+  Sketch<CountingStats, NoPayload> counted;
+  mt19937_64 r1(7), r2(7), keys(8);
+  for (int i = 0; i < 1000000; ++i) {
+    const int key = keys() % 1000000;
+    plain.Insert(&r1, key, 0);
+    counted.Insert(&r2, key, 0);
+  }
+  const auto lhs = plain.GetCdf(), rhs = counted.GetCdf();
+  for (double p = 0; p <= 100; p += 0.5) {
+    if (lhs.GetValue(p) != rhs.GetValue(p)) {
+      cerr << name << " differs at " << p << endl;
+      exit(1);
+    }
+  }
+  const SketchStats stats = counted.GetStats();
+  Print(name, stats);
+  const SketchStats none = plain.GetStats();
+  if (stats.compactions[0] == 0 || stats.comparisons == 0 || stats.random_draws == 0
+      || stats.bytes_moved == 0 || (samples && stats.shuffle_downs == 0)
+      || none.comparisons != 0) {
+    cerr << name << " counted nothing" << endl;
+    exit(1);
+  }
+}
+
+// A policy with one byte of state, which must take room in a sketch where the empty
+// NoStats takes none.
+struct ByteStats : NoStats {
+  char state = 0;
+};
+
+static_assert(sizeof(Kll<int, 200>) < sizeof(Kll<int, 200, NoPayload, ByteStats>),
+    "NoStats adds no bytes to Kll");
+static_assert(
+    sizeof(Req<int, 12>) < sizeof(Req<int, 12, HighRanks, NoPayload, ByteStats>),
+    "NoStats adds no bytes to Req");
+
+template <typename Stats, typename Payload>
+using SampledKll200 = SampledKll<int, 200, Payload, Stats>;
+template <typename Stats, typename Payload>
+using Kll200 = Kll<int, 200, Payload, Stats>;
+
+int main() {
+  Check<SampledKll200>("SampledKll", true);
+  Check<Kll200>("Kll", false);
+  cout << "OK" << endl;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+/// Optional counters for the internals of a sketch.
+///
+/// Kll, SampledKll and Req take a Stats policy as a template parameter and report
+/// compactions, ShuffleDown calls, sampled-region replacements, random draws, bytes
+/// moved, sort comparisons and recomputations of watched percentiles to it. NoStats, the
+/// default, ignores every event and its hooks are empty inline functions. A sketch
+/// derives privately from its policy, so that the empty NoStats base adds no bytes, and
+/// an uninstrumented sketch has the same layout and code as one with no policy at all.
+/// CountingStats counts the events, and the sketch's GetStats() returns a SketchStats
+/// snapshot that a metrics exporter can scrape.
+///
+/// Counting comparisons needs a comparison sort, so a sketch with CountingStats sorts
+/// with std::sort instead of the numeric kernels in numeric-sort.hpp.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+struct SketchStats {
+  // Events at deeper levels are counted in the last slot.
+  static constexpr int MAX_LEVELS = 64;
+
+  // compactions[level] counts compactions of level, and compacted_keys[level] the keys
+  // they sorted.
+  std::array<uint64_t, MAX_LEVELS> compactions{};
+  std::array<uint64_t, MAX_LEVELS> compacted_keys{};
+  uint64_t shuffle_downs = 0;
+  // Times the key standing in for the sampled region was replaced.
+  uint64_t sample_replacements = 0;
+  uint64_t random_draws = 0;
+  // Bytes of keys copied inside the sketch by compaction and ShuffleDown, counting
+  // sizeof(T) per key, so the heap bytes of a std::string are not included.
+  uint64_t bytes_moved = 0;
+  uint64_t comparisons = 0;
+  // Times the watched percentiles were recomputed from the Cdf.
+  uint64_t watch_refreshes = 0;
+};
+
+struct NoStats {
+  void OnCompaction(int, uint64_t) {}
+  void OnShuffleDown() {}
+  void OnSampleReplacement() {}
+  void OnRandomDraw() {}
+  void OnBytesMoved(uint64_t) {}
+  void OnWatchRefresh() {}
+  // Where sorts add their comparisons, or nullptr not to count them.
+  uint64_t* Comparisons() { return nullptr; }
+  SketchStats Snapshot() const { return SketchStats(); }
+};
+
+struct CountingStats {
+ private:
+  SketchStats stats_;
+
+ public:
+  void OnCompaction(int level, uint64_t keys) {
+    level = std::min(level, SketchStats::MAX_LEVELS - 1);
+    ++stats_.compactions[level];
+    stats_.compacted_keys[level] += keys;
+  }
+  void OnShuffleDown() { ++stats_.shuffle_downs; }
+  void OnSampleReplacement() { ++stats_.sample_replacements; }
+  void OnRandomDraw() { ++stats_.random_draws; }
+  void OnBytesMoved(uint64_t bytes) { stats_.bytes_moved += bytes; }
+  void OnWatchRefresh() { ++stats_.watch_refreshes; }
+  uint64_t* Comparisons() { return &stats_.comparisons; }
+  const SketchStats& Snapshot() const { return stats_; }
+};
@@ -16,10 +16,16 @@
 #include <locale>
 #include <random>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 #include <sstream>
+#include <stdexcept>
+
+#include "payload.hpp"
+#include "perf-counters.hpp"
+#include "rank-oracle.hpp"
 
 #ifndef __has_builtin
 #define __has_builtin(x) 0
@@ -37,15 +43,45 @@ T StringCast(const U& x) {
   return result;
 }
 
+// For command lines of flags such as --keys=100: the text after flag if arg starts with
+// it, and otherwise the empty string.
+inline std::string FlagValue(const std::string& arg, const char* flag) {
+  const size_t length = std::char_traits<char>::length(flag);
+  return arg.compare(0, length, flag) == 0 ? arg.substr(length) : "";
+}
+
+// Drivers exit with 2 on a command line they cannot run, and with 1 when what they test
+// fails. Prints message and returns the exit code for the former.
+inline int UsageError(const std::string& message) {
+  std::cerr << message << std::endl;
+  return 2;
+}
+
+// The environment's locale, for digit grouping in printed counts. It is built once,
+// since constructing it reads the locale database, and is the classic locale if the
+// environment names one that is not installed.
+inline const std::locale& UserLocale() {
+  static const std::locale result = [] {
+    try {
+      return std::locale("");
+    } catch (const std::runtime_error&) {
+      return std::locale::classic();
+    }
+  }();
+  return result;
+}
+
 template<typename Clock, typename F>
 auto PrintTimerWithClock(const F& f) {
   const auto start = Clock::now();
   const auto result = f();
   const auto finish = Clock::now();
   const auto delta = finish - start;
-  std::cout.imbue(std::locale(""));
-  std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(delta).count()
-            << " milliseconds" << std::endl;
+  std::ostringstream out;
+  out.imbue(UserLocale());
+  out << std::chrono::duration_cast<std::chrono::milliseconds>(delta).count()
+      << " milliseconds";
+  std::cout << out.str() << std::endl;
   return result;
 }
 
@@ -58,31 +94,74 @@ auto PrintTimer(const F& f) {
   }
 }
 
-template<typename T>
+// Places a key of weight 2^height in a sketch whose levels hold keys of power-of-two
+// weights. fits(h) says whether the sketch has a level for weight 2^h, and place(h)
+// inserts the key there. A key heavier than the top level is split into two keys of half
+// the weight until they fit, so that only compactions add levels. fits is asked again
+// after every placement, since filling the top level may raise it, so this makes
+// O(capacity) placements per level of difference between height and the top level.
+template <typename Fits, typename Place>
+void SplitHeavy(int height, const Fits& fits, const Place& place) {
+  if (fits(height)) {
+    place(height);
+    return;
+  }
+  SplitHeavy(height - 1, fits, place);
+  SplitHeavy(height - 1, fits, place);
+}
+
+template<typename T, typename Payload = NoPayload>
 struct Cdf {
  private:
   std::vector<T> values_;
   std::vector<double> percentiles_;
+  PayloadVector<Payload> exemplars_;
+  double total_;
+
+  size_t Index(double percentile) const {
+    auto i = std::lower_bound(percentiles_.begin(), percentiles_.end(), percentile);
+    if (i == percentiles_.end()) --i;
+    return i - percentiles_.begin();
+  }
 
  public:
+  // raw holds sorted (key, weight) pairs.
+  template <typename C>
+  explicit Cdf(const C& raw) : Cdf(raw, PayloadVector<Payload>()) {
+    static_assert(std::is_same<Payload, NoPayload>::value,
+        "a Cdf with payloads needs one payload per pair");
+  }
+
+  // Unless Payload is NoPayload, payloads holds one payload per pair of raw, and each
+  // distinct key keeps the payload of its first pair as its exemplar.
   template <typename C>
-  explicit Cdf(const C& raw) : values_(1, raw[0].first), percentiles_(1, raw[0].second) {
+  Cdf(const C& raw, const PayloadVector<Payload>& payloads)
+      : values_(1, raw[0].first), percentiles_(1, raw[0].second) {
     assert(std::is_sorted(raw.begin(), raw.end()));
+    exemplars_.push_back(payloads[0]);
     for (int i = 1; i < raw.size(); ++i) {
       if (raw[i].first == raw[i - 1].first) {
         percentiles_.back() += raw[i].second;
       } else {
         values_.push_back(raw[i].first);
         percentiles_.push_back(raw[i].second + percentiles_.back());
+        exemplars_.push_back(payloads[i]);
       }
     }
-    for (double& v : percentiles_) v = 100.0 * v / percentiles_.back();
+    total_ = percentiles_.back();
+    for (double& v : percentiles_) v = 100.0 * v / total_;
   }
 
+  // The total weight of the keys.
+  double Total() const { return total_; }
+
   const T& GetValue(double percentile) const {
-    auto i = std::lower_bound(percentiles_.begin(), percentiles_.end(), percentile);
-    if (i == percentiles_.end()) --i;
-    return values_[i - percentiles_.begin()];
+    return values_[Index(percentile)];
+  }
+
+  // The payload inserted with one copy of GetValue(percentile).
+  const Payload& GetExemplar(double percentile) const {
+    return exemplars_[Index(percentile)];
   }
 
   double GetPercentile(const T& value) const {
@@ -90,38 +169,37 @@ struct Cdf {
     if (i == values_.end()) --i;
     return percentiles_[i - values_.begin()];
   }
+
+  // The percentiles of the weight of keys less than value, and at most value.
+  std::pair<double, double> GetRange(const T& value) const {
+    const size_t i =
+        std::lower_bound(values_.begin(), values_.end(), value) - values_.begin();
+    const double below = (i == 0) ? 0 : percentiles_[i - 1];
+    if (i == values_.size() || values_[i] != value) return {below, below};
+    return {below, percentiles_[i]};
+  }
 };
 
 template<typename T>
-auto GroundTruth(const std::vector<T>& keys) {
-  std::unordered_map<T, std::pair<double, double>> index;
-  const double total = keys.size();
-  std::unordered_map<T, double> accum;
-  for (const auto& key : keys) ++accum[key];
-
-  std::vector<std::pair<T, double>> sorted(accum.begin(), accum.end());
-  sort(sorted.begin(), sorted.end());
-  double running = 0;
-  for (const auto& v : sorted) {
-    auto next = running + v.second;
-    assert(next <= total);
-    index[v.first] = {running / total, next / total};
-    running = next;
-  }
-  std::cout.imbue(std::locale(""));
-  std::cout << "TOTAL KEYS: " << static_cast<uintmax_t>(total) << std::endl
-            << "UNIQUE KEYS: " << index.size() << std::endl;
-  return index;
+void PrintGroundTruth(const RankOracle<T>& oracle) {
+  std::cout.imbue(UserLocale());
+  std::cout << "TOTAL KEYS: " << static_cast<uintmax_t>(oracle.Total()) << std::endl
+            << "UNIQUE KEYS: " << oracle.Unique() << std::endl;
 }
 
-auto GroundTruth(const std::string& filename) {
-  std::vector<std::string> keys;
-  std::string word;
-  std::ifstream dict(filename);
-  while (dict >> word) {
-    keys.push_back(word);
-  }
-  return GroundTruth(keys);
+template<typename T>
+RankOracle<T> GroundTruth(const std::vector<T>& keys) {
+  auto oracle = RankOracle<T>::FromKeys(keys);
+  PrintGroundTruth(oracle);
+  return oracle;
+}
+
+// Reads the file in pieces of at most about memory bytes.
+RankOracle<std::string> GroundTruth(const std::string& filename,
+    size_t memory = size_t(1) << 30) {
+  auto oracle = RankOracle<std::string>::FromFile(filename, memory);
+  PrintGroundTruth(oracle);
+  return oracle;
 }
 
 template <typename Random, typename Sketch>
@@ -131,30 +209,43 @@ Sketch ComputeSketch(const std::string& filename) {
   Random r;
   std::string word;
   std::cout << "COMPUTING SKETCH" << std::endl;
-  while (dict >> word) sketch.Insert(&r, word, 0);
+  {
+    ScopedProfiler profile("ingest");
+    while (dict >> word) sketch.Insert(&r, word, 0);
+  }
   std::cout << "SKETCH COMPUTED" << std::endl;
   return sketch;
 }
 
 template<typename Random, typename... Sketches>
 void InteractiveTest(const std::string& filename) {
-  std::cout.imbue(std::locale(""));
+  std::cout.imbue(UserLocale());
   std::cout << filename << std::endl;
-  const auto index = PrintTimer([&] { return GroundTruth(filename); });
+  const auto index = [&] {
+    ScopedProfiler profile("ground truth");
+    return GroundTruth(filename);
+  }();
   const auto sketches = std::make_tuple(ComputeSketch<Random, Sketches>(filename)...);
   double p;
   std::cout.precision(4);
   std::array<std::pair<double, double>, sizeof...(Sketches)> truths;
+  // Only the sketches' work on each query is counted, not the wait for input.
+  PerfCounters query;
+  uint64_t queries = 0;
   while (std::cin >> p) {
+    query.Start();
     const std::array<std::string, sizeof...(Sketches)> results = {
         std::get<Sketches>(sketches).GetCdf().GetValue(p)...};
+    query.Stop();
+    ++queries;
     std::transform(results.begin(), results.end(), truths.begin(),
-        [&](const std::string& result) { return index.find(result)->second; });
+        [&](const std::string& result) { return index.Range(result); });
     for (int i = 0; i < sizeof...(Sketches); ++i) {
       std::cout << 100 * truths[i].first << ' ' << 100 * truths[i].second;
       std::cout << ' ' << results[i] << std::endl;
     }
   }
+  if (queries > 0) std::cout << "query: " << query.Report(queries) << std::endl;
 }
 
 
@@ -183,64 +274,13 @@ std::string Middle(const std::string& filename) {
   return sketch.GetCdf().GetValue(50.0);
 }
 
-template <typename Random, typename Sketch>
-std::string Middle(const std::vector<std::string>& keys) {
-  Sketch sketch;
-  Random r;
-  for (const auto& key : keys) sketch.Insert(&r, key, 0);
-  return sketch.GetCdf().GetValue(50.0);
-}
-
-double Error(const std::pair<double,double>& range) {
+// How far the quantile q is from the range of quantiles that a key covers; zero if the
+// key covers it.
+double Error(const std::pair<double,double>& range, double q = 0.5) {
   const auto //
-      lo = std::max(0.0, range.first - 0.5), //
-      hi = std::max(0.0, 0.5 - range.second);
+      lo = std::max(0.0, range.first - q), //
+      hi = std::max(0.0, q - range.second);
   assert(lo >= 0);
   assert(hi >= 0);
   return std::max(lo, hi);
 }
-
-template <typename Random, typename... Sketches>
-void Quality(const std::string& filename) {
-  std::vector<std::string> keys;
-  {
-    std::string word;
-    std::ifstream file(filename);
-    while (file >> word) keys.push_back(word);
-  }
-
-  const auto index = PrintTimer([&] { return GroundTruth(keys); });
-  uint64_t count = 0;
-  std::array<double, sizeof...(Sketches)> sum_abs_error{}, max_error{}, sum_sqr_error{};
-  std::array<std::string, sizeof...(Sketches)> estimates;
-  std::array<std::pair<double, double>, sizeof...(Sketches)> truths;
-  std::array<double, sizeof...(Sketches)> errors;
-  for (uint64_t count = 1; true; ++count) {
-    estimates = {Middle<Random, Sketches>(keys)...};
-    //std::cout << std::endl;
-    std::transform(estimates.begin(), estimates.end(), errors.begin(), [&](const auto& s) {
-      return Error(index.find(s)->second);
-    });
-
-    std::transform(errors.begin(), errors.end(), sum_abs_error.begin(),
-              sum_abs_error.begin(), std::plus<>());
-    /*
-    std::transform(errors.begin(), errors.end(), sum_sqr_error.begin(), sum_sqr_error.begin(),
-        [](double err, double sum) { return err * err + sum; });
-    */
-    std::transform(errors.begin(), errors.end(), max_error.begin(), max_error.begin(),
-        [](double err, double big) { return std::max(err, big); });
-    if (static_cast<uint64_t>(sqrt(count)) * static_cast<uint64_t>(sqrt(count))
-        == count) {
-      std::cout.precision(4);
-      std::cout << std::fixed;
-      std::cout << std::setw(6) << count;
-      for (auto v : sum_abs_error) std::cout << std::setw(8) << 100 * v / count;
-      std::cout << std::endl << std::setw(6) << "max";
-      for (auto v : max_error) std::cout << std::setw(8) << 100 * v;
-      // for (auto v : sum_sqr_error) std::cout << 100 * sqrt(v / count) << ' ';
-      std::cout << std::endl;
-    }
-  }
-
-}
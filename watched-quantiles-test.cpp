@@ -0,0 +1,87 @@
+#include "kll.hpp"
+#include "sampled-kll.hpp"
+#include "stats.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace std;
+
+const double PERCENTILES[] = {0.1, 50, 99, 99.9};
+
+// Every watched key must cover its percentile in the Cdf, to within tolerance
+// percentiles. The watch tracks the sketch's own weights, so there is no sketch error to
+// allow for.
+template <typename Sketch>
+void Check(const char* name, const Sketch& sketch, double tolerance) {
+  const auto cdf = sketch.GetCdf();
+  for (size_t i = 0; i < 4; ++i) {
+    const auto range = cdf.GetRange(sketch.GetWatched(i));
+    const double slack = tolerance + 1e-9;
+    if (range.first - slack <= PERCENTILES[i] && PERCENTILES[i] <= range.second + slack) {
+      continue;
+    }
+    cerr << name << ": watched p" << PERCENTILES[i] << " covers " << range.first << " to "
+         << range.second << " with tolerance " << tolerance << endl;
+    exit(1);
+  }
+}
+
+// Mixes single and weighted inserts of skewed keys with merges of a second sketch.
+// Returns the number of times the watch was recomputed from the Cdf.
+template <typename Sketch, typename Key>
+uint64_t Run(const char* name, Key key, double tolerance) {
+  mt19937_64 r(11);
+  Sketch sketch, other;
+  for (const double p : PERCENTILES) sketch.Watch(p, tolerance);
+  for (int i = 0; i < 40000; ++i) {
+    if (i % 97 == 0) {
+      sketch.InsertWeighted(&r, key(&r), r() % 5000 + 1);
+    } else if (i % 5003 == 0) {
+      sketch.Merge(&r, other);
+    } else {
+      sketch.Insert(&r, key(&r), 0);
+      other.Insert(&r, key(&r), 0);
+    }
+    Check(name, sketch, tolerance);
+  }
+  const uint64_t refreshes = sketch.GetStats().watch_refreshes;
+  cout << name << " tolerance " << tolerance << ": " << refreshes << " refreshes OK"
+       << endl;
+  return refreshes;
+}
+
+// The watch follows inserts and compactions itself, and recomputes from the Cdf only
+// rarely, and no more often with a tolerance than without one.
+template <typename Sketch, typename Key>
+void RunAll(const char* name, Key key) {
+  const uint64_t exact = Run<Sketch>(name, key, 0);
+  for (const double tolerance : {0.01, 0.5}) {
+    const uint64_t refreshes = Run<Sketch>(name, key, tolerance);
+    if (refreshes > exact || refreshes > 40000 / 50) {
+      cerr << name << ": " << refreshes << " refreshes with tolerance " << tolerance
+           << endl;
+      exit(1);
+    }
+  }
+}
+
+uint64_t Number(mt19937_64* r) { return (*r)() % 1000 * ((*r)() % 1000); }
+string Text(mt19937_64* r) { return to_string(Number(r)); }
+
+template <typename T, uint32_t N>
+using CountingKll = Kll<T, N, NoPayload, CountingStats>;
+template <typename T, uint32_t N>
+using CountingLazyKll = Kll<T, N, NoPayload, CountingStats, ItemBudget, LazyCompaction>;
+template <typename T, int32_t N>
+using CountingSampledKll = SampledKll<T, N, NoPayload, CountingStats>;
+
+int main() {
+  RunAll<CountingKll<uint64_t, 200>>("Kll<uint64_t, 200>", Number);
+  RunAll<CountingLazyKll<uint64_t, 200>>("LazyKll<uint64_t, 200>", Number);
+  RunAll<CountingSampledKll<uint64_t, 200>>("SampledKll<uint64_t, 200>", Number);
+  RunAll<CountingSampledKll<string, 100>>("SampledKll<string, 100>", Text);
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+/// Percentiles that a sketch keeps current as keys arrive, for callers that poll the
+/// same percentiles, such as p50, p99 and p99.9, after every batch.
+///
+/// WatchedQuantiles<T> holds, for each watched percentile, the key that the sketch's Cdf
+/// would return for it, along with the sketch's weight of keys less than that key and
+/// equal to it. The sketch reports every change to its weights: keys that arrive with
+/// Add(), keys that move between its sample and its levels with Move() and Remove(), and
+/// each compaction with Compact(), which works out from the sorted level and the parity
+/// of the survivors how much weight crossed each watched key in O(log level) time.
+///
+/// While a percentile's target rank stays within the range of ranks its key covers, that
+/// key is still the Cdf's answer, so Get() costs O(1) and matches GetCdf().GetValue().
+/// The sketch recomputes the watch from its Cdf when a target leaves its range by more
+/// than the percentile's tolerance, and after it rearranges itself in ways it does not
+/// report. Weights are integers, which doubles hold exactly up to 2^53, so the watch
+/// only drifts from the Cdf on enormous streams; recomputing it every refresh_interval
+/// updates bounds that drift too.
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "memory.hpp"
+
+template <typename T>
+class WatchedQuantiles {
+  struct Watched {
+    double percentile, tolerance;
+    T key;
+    // The sketch's weight of keys less than key, and equal to it.
+    double below, at;
+  };
+
+  std::vector<Watched> watched_;
+  double total_ = 0;
+  uint64_t refresh_interval_;
+  uint64_t updates_ = 0;
+  bool valid_ = false;
+
+  void Shift(const T& key, double weight) {
+    total_ += weight;
+    for (auto& w : watched_) {
+      if (key < w.key) {
+        w.below += weight;
+      } else if (!(w.key < key)) {
+        w.at += weight;
+      }
+    }
+  }
+
+ public:
+  explicit WatchedQuantiles(uint64_t refresh_interval)
+      : refresh_interval_(refresh_interval) {}
+
+  bool Empty() const { return watched_.empty(); }
+
+  // Returns the index to pass to Get(). The watch needs a refresh before Get() answers.
+  size_t Watch(double percentile, double tolerance) {
+    watched_.push_back({percentile, tolerance, T(), 0, 0});
+    valid_ = false;
+    return watched_.size() - 1;
+  }
+
+  const T& Get(size_t i) const { return watched_[i].key; }
+
+  size_t HeapBytes() const {
+    size_t result = watched_.capacity() * sizeof(Watched);
+    for (const auto& w : watched_) result += ::HeapBytes(w.key);
+    return result;
+  }
+
+  void Add(const T& key, double weight) {
+    if (Empty()) return;
+    Shift(key, weight);
+    ++updates_;
+  }
+
+  void Remove(const T& key, double weight) {
+    if (!Empty()) Shift(key, -weight);
+  }
+
+  void Move(const T& from, const T& to, double weight) {
+    if (Empty()) return;
+    Shift(from, -weight);
+    Shift(to, weight);
+  }
+
+  // keys[0, len) is a level of keys of the given weight, sorted unless len <= 2. Keys at
+  // positions of offset's parity survive at twice the weight, and the others are dropped.
+  void Compact(const T* keys, size_t len, size_t offset, double weight) {
+    if (Empty()) return;
+    if (len <= 2) {
+      for (size_t i = 0; i < len; ++i) {
+        Shift(keys[i], (i % 2 == offset) ? weight : -weight);
+      }
+      return;
+    }
+    // The change in the weight of the first p keys: survivors gain weight, and the others
+    // lose it.
+    const auto change = [offset, weight](size_t p) {
+      const size_t kept = (p + 1 - offset) / 2;
+      return weight * (2.0 * kept - p);
+    };
+    total_ += change(len);
+    for (auto& w : watched_) {
+      const size_t less = std::lower_bound(keys, keys + len, w.key) - keys;
+      const size_t at_most = std::upper_bound(keys + less, keys + len, w.key) - keys;
+      w.below += change(less);
+      w.at += change(at_most) - change(less);
+    }
+  }
+
+  // For changes the sketch does not report.
+  void Invalidate() { valid_ = false; }
+
+  bool NeedsRefresh() const {
+    if (Empty()) return false;
+    if (!valid_ || updates_ >= refresh_interval_) return true;
+    for (const auto& w : watched_) {
+      const double target = w.percentile / 100 * total_;
+      const double slack = w.tolerance / 100 * total_;
+      if (target < w.below - slack || w.below + w.at + slack < target) return true;
+    }
+    return false;
+  }
+
+  template <typename Cdf>
+  void Refresh(const Cdf& cdf) {
+    total_ = cdf.Total();
+    for (auto& w : watched_) {
+      w.key = cdf.GetValue(w.percentile);
+      const auto range = cdf.GetRange(w.key);
+      w.below = range.first / 100 * total_;
+      w.at = (range.second - range.first) / 100 * total_;
+    }
+    updates_ = 0;
+    valid_ = true;
+  }
+};
@@ -0,0 +1,188 @@
+#include "check.hpp"
+#include "kll.hpp"
+#include "req.hpp"
+#include "sampled-kll.hpp"
+#include "utility.hpp"
+#include "weighted-cdf.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+template <typename T>
+WeightedCdf<T> Summary(vector<pair<T, uint64_t>> raw) {
+  sort(raw.begin(), raw.end());
+  return WeightedCdf<T>(raw);
+}
+
+template <typename Call>
+void CheckThrows(const Call& call, const char* what) {
+  bool threw = false;
+  try {
+    call();
+  } catch (const runtime_error&) {
+    threw = true;
+  }
+  Check(threw, what);
+}
+
+template <typename T>
+void CheckRefused(const string& bytes, const char* what) {
+  CheckThrows([&bytes] { WeightedCdf<T>::Decode(bytes); }, what);
+}
+
+template <typename T>
+void CheckRoundTrip(const WeightedCdf<T>& cdf, const char* what) {
+  const string bytes = cdf.Encode();
+  Check(WeightedCdf<T>::Decode(bytes).Encode() == bytes, what);
+  CheckRefused<T>(bytes.substr(0, bytes.size() - 1), "truncated summaries are refused");
+}
+
+// Well-framed bytes that do not encode a summary.
+void CheckMalformed() {
+  // Keys 5 and 9 of weights 1 and 2: the count, then each key's delta and weight.
+  const string good("\x02\x05\x01\x04\x02", 5);
+  Check(WeightedCdf<uint64_t>::Decode(good).Total() == 3, "well-formed");
+  CheckRefused<uint64_t>(string("\x02\x05\x01\x00\x02", 5), "repeated key");
+  CheckRefused<uint64_t>(string("\x02\x05\x00\x04\x02", 5), "zero weight");
+  const string most("\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01", 10);
+  CheckRefused<uint64_t>("\x02\x05" + most + "\x04\x01", "overflowing weight");
+  const double keys[] = {2.0, 1.0};
+  string backwards("\x02", 1);
+  for (const double key : keys) {
+    backwards.append(reinterpret_cast<const char*>(&key), sizeof(key));
+    backwards.push_back('\x01');
+  }
+  CheckRefused<double>(backwards, "decreasing floating-point keys");
+  // "ab", then a key sharing all of "ab" and adding nothing.
+  CheckRefused<string>(
+      string("\x02\x00\x02" "ab" "\x01\x02\x00\x01", 9), "repeated string");
+  const vector<pair<uint64_t, uint64_t>> zero = {{1, 0}, {2, 3}, {2, 0}, {4, 0}};
+  const WeightedCdf<uint64_t> skipped(zero);
+  Check(skipped.Size() == 1 && skipped.Total() == 3, "keys of no weight are left out");
+  CheckRoundTrip(skipped, "round trip without keys of no weight");
+}
+
+// A summary of nothing, built, merged or decoded, answers no lookups but merges as
+// nothing.
+void CheckEmpty() {
+  const WeightedCdf<uint64_t> one(vector<pair<uint64_t, uint64_t>>{{7, 2}});
+  const vector<WeightedCdf<uint64_t>> empties = {WeightedCdf<uint64_t>(),
+      WeightedCdf<uint64_t>().Merge(WeightedCdf<uint64_t>()),
+      WeightedCdf<uint64_t>::Merge(vector<WeightedCdf<uint64_t>>()),
+      WeightedCdf<uint64_t>::Decode(WeightedCdf<uint64_t>().Encode()),
+      WeightedCdf<uint64_t>::FromUnsorted(vector<pair<uint64_t, uint64_t>>{{3, 0}}),
+      Kll<uint64_t, 100>().GetWeightedCdf()};
+  for (const auto& empty : empties) {
+    Check(empty.Size() == 0 && empty.Total() == 0, "empty summary");
+    Check(empty.Ranks(7) == make_pair(uint64_t{0}, uint64_t{0}), "empty ranks");
+    CheckThrows([&] { empty.GetValue(50); }, "GetValue of an empty summary");
+    CheckThrows([&] { empty.GetRange(7); }, "GetRange of an empty summary");
+    Check(empty.Merge(one).Encode() == one.Encode(), "empty merges as nothing");
+    Check(one.Merge(empty).Encode() == one.Encode(), "merges with empty as itself");
+  }
+}
+
+int main() {
+  mt19937_64 r(5);
+
+  // Percentiles answer as Cdf does.
+  vector<pair<int64_t, uint64_t>> raw;
+  for (int i = 0; i < 100000; ++i) {
+    raw.push_back({static_cast<int64_t>(r() % 50000) - 25000, 1 + r() % 10});
+  }
+  sort(raw.begin(), raw.end());
+  const WeightedCdf<int64_t> all(raw);
+  vector<pair<int64_t, int64_t>> signed_raw(raw.begin(), raw.end());
+  PayloadVector<NoPayload> payloads;
+  const Cdf<int64_t> cdf(signed_raw, payloads);
+  Check(all.Total() == cdf.Total(), "total");
+  for (double p = 0; p <= 100; p += 0.37) {
+    Check(all.GetValue(p) == cdf.GetValue(p), "GetValue matches Cdf");
+    Check(all.GetRange(all.GetValue(p)) == cdf.GetRange(cdf.GetValue(p)), "GetRange");
+  }
+
+  // Merging the summaries of shards gives the summary of their union.
+  vector<WeightedCdf<int64_t>> shards;
+  for (size_t s = 0; s < 5; ++s) {
+    vector<pair<int64_t, uint64_t>> part;
+    for (size_t i = s; i < raw.size(); i += 5) part.push_back(raw[i]);
+    shards.push_back(Summary(part));
+  }
+  Check(shards[0].Merge(shards[1]).Merge(shards[2]).Merge(shards[3]).Merge(shards[4])
+      .Encode() == all.Encode(), "merge is exact");
+  Check(WeightedCdf<int64_t>::Merge(shards).Encode() == all.Encode(), "merge of many");
+
+  // Downsampled summaries keep exact cumulative weights at k points.
+  for (const size_t k : {10, 100, 1000}) {
+    const auto small = all.Downsample(k);
+    Check(small.Size() <= k && small.Total() == all.Total(), "downsampled size");
+    double worst = 0;
+    for (double p = 0; p <= 100; p += 0.1) {
+      const auto range = all.GetRange(small.GetValue(p));
+      worst = max(worst, max(range.first - p, p - range.second));
+    }
+    cout << "k=" << k << " worst error " << worst << " percentiles, "
+         << small.Encode().size() << " bytes" << endl;
+    Check(worst <= 100.0 / k + 0.01, "downsampled error");
+    for (const auto& key : {small.GetValue(10), small.GetValue(90)}) {
+      Check(small.Ranks(key).second == all.Ranks(key).second, "kept weights are exact");
+    }
+  }
+
+  CheckRoundTrip(all, "int64 round trip");
+  CheckRoundTrip(all.Downsample(100), "downsampled round trip");
+  vector<pair<double, uint64_t>> doubles;
+  vector<pair<string, uint64_t>> strings;
+  for (int i = 0; i < 10000; ++i) {
+    doubles.push_back({normal_distribution<double>()(r), 1 + r() % 3});
+    strings.push_back({"/api/v1/users/" + to_string(r() % 5000), 1});
+  }
+  CheckRoundTrip(Summary(doubles), "double round trip");
+  CheckRoundTrip(Summary(strings), "string round trip");
+  CheckMalformed();
+  CheckEmpty();
+
+  // A federated query: each shard ships 200 points, and the merge answers within a
+  // percentile or so of the merge of the whole sketches.
+  vector<uint32_t> keys(1000000);
+  for (auto& key : keys) key = r() % 1000000;
+  vector<WeightedCdf<uint32_t>> shipped, whole;
+  for (size_t s = 0; s < 4; ++s) {
+    SampledKll<uint32_t, 1000> sketch;
+    for (size_t i = s; i < keys.size(); i += 4) sketch.Insert(&r, keys[i], 0);
+    const auto summary = sketch.GetWeightedCdf();
+    Check(summary.GetValue(99) == sketch.GetCdf().GetValue(99), "SampledKll summary");
+    whole.push_back(summary);
+    shipped.push_back(WeightedCdf<uint32_t>::Decode(summary.Downsample(200).Encode()));
+  }
+  const auto exact = WeightedCdf<uint32_t>::Merge(whole);
+  const auto federated = WeightedCdf<uint32_t>::Merge(shipped);
+  Check(federated.Total() == exact.Total(), "federated total");
+  for (const double p : {1.0, 50.0, 99.0}) {
+    const auto range = exact.GetRange(federated.GetValue(p));
+    Check(range.first <= p + 1 && range.second >= p - 1, "federated percentile");
+  }
+
+  Kll<uint32_t, 1000> kll;
+  Req<uint32_t, 12> req;
+  for (const auto key : keys) {
+    kll.Insert(&r, key, 0);
+    req.Insert(&r, key, 0);
+  }
+  for (const double p : {1.0, 50.0, 99.9}) {
+    Check(kll.GetWeightedCdf().GetValue(p) == kll.GetCdf().GetValue(p), "Kll summary");
+    Check(req.GetWeightedCdf().GetValue(p) == req.GetCdf().GetValue(p), "Req summary");
+  }
+  Check(req.GetWeightedCdf().Total() == keys.size(), "Req total");
+  cout << "OK" << endl;
+}
@@ -0,0 +1,280 @@
+#pragma once
+
+/// Cdf summaries that keep integer weights, so that the summaries of many shards can be
+/// combined exactly.
+///
+/// Cdf<T> turns weights into percentiles as soon as it is built, which loses the total
+/// weight and rounds every point. WeightedCdf<T> instead keeps, beside each distinct key
+/// in order, the total weight of keys up to and including it as a uint64_t. Merge()
+/// adds two summaries in one pass over both, in O(n + m) time, and the result is the
+/// summary of both streams' keys, so a federated query may merge the summaries of its
+/// shards in any order and get the same answer. GetValue() answers as Cdf<T> does.
+///
+/// Downsample(k) keeps at most k points, spaced evenly in weight, each with its exact
+/// cumulative weight. Between two kept points lies at most 1 / k of the weight, plus
+/// that of a single key, so its answers are off from the full summary's by about 100 / k
+/// percentiles, and a shard ships k points rather than its sketch. Encode() writes a
+/// summary as bytes: each key as the difference from the key before it (integers), as
+/// raw bytes (floating point) or front coded against the key before it (strings), and
+/// each weight as a varint. Decode() reads it back, and throws on input that is not the
+/// encoding of a summary: truncated, out of order, of zero weight or overflowing.
+///
+/// An empty summary, such as that of a sketch nothing was inserted into, merges as
+/// nothing and encodes and decodes as usual, but has no value at any percentile and no
+/// percentile for any key: GetValue() and GetRange() throw on it.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "payload.hpp"
+
+template <typename T>
+class WeightedCdf {
+  std::vector<T> values_;
+  // cumulative_[i] is the total weight of keys at most values_[i].
+  std::vector<uint64_t> cumulative_;
+
+  // Keys must arrive in order. Keys of no weight are left out.
+  void Append(const T& value, uint64_t weight) {
+    if (weight == 0) return;
+    if (!values_.empty() && !(values_.back() < value)) {
+      cumulative_.back() += weight;
+    } else {
+      values_.push_back(value);
+      cumulative_.push_back(Total() + weight);
+    }
+  }
+
+  size_t Index(double percentile) const {
+    CheckNotEmpty();
+    const double total = Total();
+    auto i = std::lower_bound(cumulative_.begin(), cumulative_.end(), percentile,
+        [total](uint64_t weight, double p) { return 100.0 * weight / total < p; });
+    if (i == cumulative_.end()) --i;
+    return i - cumulative_.begin();
+  }
+
+  void CheckNotEmpty() const {
+    if (values_.empty()) throw std::runtime_error("empty WeightedCdf");
+  }
+
+  static void PutVarint(std::string* out, uint64_t x) {
+    while (x >= 0x80) {
+      out->push_back(static_cast<char>(x | 0x80));
+      x >>= 7;
+    }
+    out->push_back(static_cast<char>(x));
+  }
+
+  static uint64_t GetVarint(const char** in, const char* end) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (*in == end) break;
+      const uint8_t byte = static_cast<uint8_t>(*(*in)++);
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (byte < 0x80) return result;
+    }
+    throw std::runtime_error("truncated WeightedCdf");
+  }
+
+  // How Encode() writes keys: integers as their difference from the key before,
+  // floating point as raw bytes, and strings front coded against the key before.
+  using Integral = std::integral_constant<int, 0>;
+  using Floating = std::integral_constant<int, 1>;
+  using Other = std::integral_constant<int, 2>;
+  using Coding = std::conditional_t<std::is_integral<T>::value, Integral,
+      std::conditional_t<std::is_floating_point<T>::value, Floating, Other>>;
+
+  template <typename U>
+  static void PutKey(std::string* out, const U& key, const U& previous, Integral) {
+    using Unsigned = std::make_unsigned_t<U>;
+    const Unsigned delta = static_cast<Unsigned>(key) - static_cast<Unsigned>(previous);
+    PutVarint(out, delta);
+  }
+
+  template <typename U>
+  static U GetKey(const char** in, const char* end, const U& previous, Integral) {
+    using Unsigned = std::make_unsigned_t<U>;
+    return static_cast<U>(static_cast<Unsigned>(previous + GetVarint(in, end)));
+  }
+
+  template <typename U>
+  static void PutKey(std::string* out, const U& key, const U&, Floating) {
+    out->append(reinterpret_cast<const char*>(&key), sizeof(U));
+  }
+
+  template <typename U>
+  static U GetKey(const char** in, const char* end, const U&, Floating) {
+    if (end - *in < static_cast<ptrdiff_t>(sizeof(U))) {
+      throw std::runtime_error("truncated WeightedCdf");
+    }
+    U result;
+    std::memcpy(&result, *in, sizeof(U));
+    *in += sizeof(U);
+    return result;
+  }
+
+  // The length of the prefix shared with the key before, then the rest.
+  static void PutKey(std::string* out, const std::string& key,
+      const std::string& previous, Other) {
+    const size_t limit = std::min(key.size(), previous.size());
+    const size_t shared =
+        std::mismatch(key.begin(), key.begin() + limit, previous.begin()).first
+        - key.begin();
+    PutVarint(out, shared);
+    PutVarint(out, key.size() - shared);
+    out->append(key, shared, std::string::npos);
+  }
+
+  static std::string GetKey(const char** in, const char* end, const std::string& previous,
+      Other) {
+    const uint64_t shared = GetVarint(in, end);
+    const uint64_t length = GetVarint(in, end);
+    if (shared > previous.size() || length > static_cast<uint64_t>(end - *in)) {
+      throw std::runtime_error("malformed WeightedCdf");
+    }
+    std::string result = previous.substr(0, shared);
+    result.append(*in, length);
+    *in += length;
+    return result;
+  }
+
+ public:
+  WeightedCdf() = default;
+
+  // raw holds sorted (key, weight) pairs with integer weights.
+  template <typename C>
+  explicit WeightedCdf(const C& raw) {
+    for (const auto& p : raw) Append(p.first, p.second);
+  }
+
+  // The summary of a sketch's (key, weight) pairs, in any order. Sketches sort them
+  // here, as their GetCdf() does, rather than each with its own copy of the sort.
+  template <typename W>
+  static WeightedCdf FromUnsorted(std::vector<std::pair<T, W>> raw) {
+    PayloadVector<NoPayload> payloads;
+    SortWithPayloads(raw.data(), raw.size(), &payloads, 0);
+    return WeightedCdf(raw);
+  }
+
+  uint64_t Total() const { return cumulative_.empty() ? 0 : cumulative_.back(); }
+
+  // The number of distinct keys.
+  size_t Size() const { return values_.size(); }
+
+  const T& GetValue(double percentile) const { return values_[Index(percentile)]; }
+
+  // The weight of keys less than value, and at most value.
+  std::pair<uint64_t, uint64_t> Ranks(const T& value) const {
+    const size_t i =
+        std::lower_bound(values_.begin(), values_.end(), value) - values_.begin();
+    const uint64_t below = (i == 0) ? 0 : cumulative_[i - 1];
+    if (i == values_.size() || values_[i] != value) return {below, below};
+    return {below, cumulative_[i]};
+  }
+
+  // The percentiles of the weight of keys less than value, and at most value.
+  std::pair<double, double> GetRange(const T& value) const {
+    CheckNotEmpty();
+    const auto ranks = Ranks(value);
+    return {100.0 * ranks.first / Total(), 100.0 * ranks.second / Total()};
+  }
+
+  // The summary of the keys of both summaries, in O(Size() + that.Size()) time.
+  WeightedCdf Merge(const WeightedCdf& that) const {
+    WeightedCdf result;
+    result.values_.reserve(Size() + that.Size());
+    result.cumulative_.reserve(Size() + that.Size());
+    size_t i = 0, j = 0;
+    uint64_t mine = 0, theirs = 0;
+    while (i < Size() || j < that.Size()) {
+      const bool take_mine = j == that.Size()
+          || (i < Size() && !(that.values_[j] < values_[i]));
+      const bool take_theirs = i == Size()
+          || (j < that.Size() && !(values_[i] < that.values_[j]));
+      const T& value = take_mine ? values_[i] : that.values_[j];
+      if (take_mine) mine = cumulative_[i++];
+      if (take_theirs) theirs = that.cumulative_[j++];
+      result.values_.push_back(value);
+      result.cumulative_.push_back(mine + theirs);
+    }
+    return result;
+  }
+
+  // Merges summaries pairwise, in O(n log summaries.size()) time for n keys in all.
+  static WeightedCdf Merge(std::vector<WeightedCdf> summaries) {
+    if (summaries.empty()) return WeightedCdf();
+    for (size_t width = 1; width < summaries.size(); width *= 2) {
+      for (size_t i = 0; i + width < summaries.size(); i += 2 * width) {
+        summaries[i] = summaries[i].Merge(summaries[i + width]);
+      }
+    }
+    return std::move(summaries[0]);
+  }
+
+  // At most k of the keys: the first whose cumulative weight reaches each multiple of
+  // Total() / k, with their cumulative weights.
+  WeightedCdf Downsample(size_t k) const {
+    if (k == 0 || Size() <= k) return *this;
+    WeightedCdf result;
+    const double step = static_cast<double>(Total()) / k;
+    double next = step;
+    for (size_t i = 0; i < Size(); ++i) {
+      if (cumulative_[i] < next && i + 1 < Size()) continue;
+      result.values_.push_back(values_[i]);
+      result.cumulative_.push_back(cumulative_[i]);
+      next = (std::floor(cumulative_[i] / step) + 1) * step;
+    }
+    return result;
+  }
+
+  std::string Encode() const {
+    static_assert(
+        !std::is_same<Coding, Other>::value || std::is_same<T, std::string>::value,
+        "WeightedCdf encodes arithmetic and std::string keys");
+    std::string result;
+    PutVarint(&result, Size());
+    T previous = T();
+    uint64_t below = 0;
+    for (size_t i = 0; i < Size(); ++i) {
+      PutKey(&result, values_[i], previous, Coding());
+      PutVarint(&result, cumulative_[i] - below);
+      previous = values_[i];
+      below = cumulative_[i];
+    }
+    return result;
+  }
+
+  static WeightedCdf Decode(const std::string& bytes) {
+    const char* in = bytes.data();
+    const char* const end = in + bytes.size();
+    const uint64_t size = GetVarint(&in, end);
+    // Every point takes at least two bytes.
+    if (size > bytes.size()) throw std::runtime_error("malformed WeightedCdf");
+    WeightedCdf result;
+    result.values_.reserve(size);
+    result.cumulative_.reserve(size);
+    T previous = T();
+    for (uint64_t i = 0; i < size; ++i) {
+      previous = GetKey(&in, end, previous, Coding());
+      const uint64_t weight = GetVarint(&in, end);
+      // Lookups need keys in strictly increasing order, each with some weight.
+      if ((i > 0 && !(result.values_.back() < previous)) || weight == 0
+          || weight > std::numeric_limits<uint64_t>::max() - result.Total()) {
+        throw std::runtime_error("malformed WeightedCdf");
+      }
+      result.values_.push_back(previous);
+      result.cumulative_.push_back(result.Total() + weight);
+    }
+    if (in != end) throw std::runtime_error("malformed WeightedCdf");
+    return result;
+  }
+};
@@ -0,0 +1,70 @@
+#include "kll.hpp"
+#include "sampled-kll.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <random>
+
+using namespace std;
+
+// Feeds a sketch (value, count) pairs with counts up to the millions and checks every
+// distinct value's estimated percentile against the exact one.
+template <typename Sketch>
+void Check(const char* name) {
+  mt19937_64 r(31415);
+  map<int, uint64_t> exact;
+  uniform_int_distribution<int> values(0, 999);
+  for (int i = 0; i < 5000; ++i) {
+    const int value = values(r);
+    const uint64_t count = uint64_t{1} << uniform_int_distribution<int>(0, 22)(r);
+    const uint64_t weight = uniform_int_distribution<uint64_t>(1, count)(r);
+    exact[value] += weight;
+  }
+  Sketch sketch;
+  uint64_t total = 0;
+  for (const auto& p : exact) total += p.second;
+  // Insert in a scrambled order, so the sketch does not see sorted input.
+  vector<pair<int, uint64_t>> shuffled(exact.begin(), exact.end());
+  shuffle(shuffled.begin(), shuffled.end(), r);
+  for (const auto& p : shuffled) sketch.InsertWeighted(&r, p.first, p.second);
+  const auto cdf = sketch.GetCdf();
+  uint64_t running = 0;
+  double max_error = 0;
+  for (const auto& p : exact) {
+    running += p.second;
+    max_error = max(max_error, abs(cdf.GetPercentile(p.first) - 100.0 * running / total));
+  }
+  cout << name << " max error " << max_error << " percentile" << endl;
+  if (max_error > 3.0) exit(1);
+}
+
+// InsertWeighted(key, w) with small w must agree exactly with w calls to Insert while the
+// sketch has not compacted anything.
+template <typename Sketch>
+void CheckSmall(const char* name) {
+  mt19937_64 r(1);
+  Sketch weighted, repeated;
+  for (int key = 0; key < 10; ++key) {
+    weighted.InsertWeighted(&r, key, key + 1);
+    for (int i = 0; i <= key; ++i) repeated.Insert(&r, key, 0);
+  }
+  const auto lhs = weighted.GetCdf(), rhs = repeated.GetCdf();
+  for (int key = 0; key < 10; ++key) {
+    if (abs(lhs.GetPercentile(key) - rhs.GetPercentile(key)) > 1e-9) {
+      cerr << name << " differs at " << key << endl;
+      exit(1);
+    }
+  }
+  cout << "OK " << name << endl;
+}
+
+int main() {
+  Check<SampledKll<int, 1000>>("SampledKll");
+  Check<Kll<int, 1000>>("Kll");
+  Check<LazyKll<int, 1000>>("LazyKll");
+  CheckSmall<SampledKll<int, 1000>>("SampledKll");
+  CheckSmall<Kll<int, 1000>>("Kll");
+  CheckSmall<LazyKll<int, 1000>>("LazyKll");
+}